@@ -0,0 +1,113 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "rtweekend.h"
+
+#include "ray_packet.h"
+
+#include <utility>
+
+// Axis-aligned bounding box, one interval per axis
+class aabb {
+public:
+	interval x, y, z;
+
+	aabb() {} // The default AABB is empty, since intervals are empty by default
+	aabb(const interval& ix, const interval& iy, const interval& iz) : x(ix), y(iy), z(iz) {}
+
+	aabb(const point3& a, const point3& b) {
+		// Treat the two points a and b as extrema for the bounding box
+		x = interval(fmin(a[0], b[0]), fmax(a[0], b[0]));
+		y = interval(fmin(a[1], b[1]), fmax(a[1], b[1]));
+		z = interval(fmin(a[2], b[2]), fmax(a[2], b[2]));
+	}
+
+	aabb(const aabb& box0, const aabb& box1)
+		: x(box0.x, box1.x), y(box0.y, box1.y), z(box0.z, box1.z) {}
+
+	// give flat boxes (planar primitives) some thickness, the slab test misses empty slabs
+	void pad_to_minimums() {
+		const float delta = 0.0001f;
+		if (x.size() < delta) x = x.expand(delta);
+		if (y.size() < delta) y = y.expand(delta);
+		if (z.size() < delta) z = z.expand(delta);
+	}
+
+	const interval& axis(int n) const {
+		if (n == 1) return y;
+		if (n == 2) return z;
+		return x;
+	}
+
+	bool is_empty() const {
+		return x.min > x.max || y.min > y.max || z.min > z.max;
+	}
+
+	point3 centroid() const {
+		return point3(0.5f * (x.min + x.max), 0.5f * (y.min + y.max), 0.5f * (z.min + z.max));
+	}
+
+	float surface_area() const {
+		if (is_empty()) return 0.f;
+		return 2.f * (x.size() * y.size() + y.size() * z.size() + z.size() * x.size());
+	}
+
+	int longest_axis() const {
+		if (x.size() > y.size())
+			return x.size() > z.size() ? 0 : 2;
+		return y.size() > z.size() ? 1 : 2;
+	}
+
+	bool hit(const ray& r, interval ray_t) const {
+		point3 origin = r.origin();
+		vec3 direction = r.direction();
+
+		// slab test: clip the ray interval against each pair of planes
+		for (int a = 0; a < 3; a++) {
+			auto invD = 1.f / direction[a];
+			auto t0 = (axis(a).min - origin[a]) * invD;
+			auto t1 = (axis(a).max - origin[a]) * invD;
+			if (invD < 0) std::swap(t0, t1);
+
+			if (t0 > ray_t.min) ray_t.min = t0;
+			if (t1 < ray_t.max) ray_t.max = t1;
+
+			if (ray_t.max <= ray_t.min)
+				return false;
+		}
+		return true;
+	}
+
+	// slab test of every lane in mask at once, returns the lanes that hit the box
+	unsigned int hit_packet(const ray_packet& packet, unsigned int mask) const {
+		float t0[ray_packet::max_size], t1[ray_packet::max_size];
+
+		// plain lane loops over the SoA arrays, so the compiler can vectorize them
+		for (int l = 0; l < ray_packet::max_size; l++) {
+			t0[l] = packet.tmin;
+			t1[l] = packet.tmax[l];
+		}
+		clip_lanes(x, packet.ox, packet.inv_dx, t0, t1);
+		clip_lanes(y, packet.oy, packet.inv_dy, t0, t1);
+		clip_lanes(z, packet.oz, packet.inv_dz, t0, t1);
+
+		unsigned int hits = 0;
+		for (int l = 0; l < packet.size; l++)
+			hits |= (t1[l] > t0[l] ? 1u : 0u) << l;
+		return hits & mask;
+	}
+
+private:
+	static void clip_lanes(const interval& slab, const float* origin, const float* inv_dir, float* t0, float* t1) {
+		for (int l = 0; l < ray_packet::max_size; l++) {
+			float ta = (slab.min - origin[l]) * inv_dir[l];
+			float tb = (slab.max - origin[l]) * inv_dir[l];
+			float near_t = ta < tb ? ta : tb;
+			float far_t = ta < tb ? tb : ta;
+			t0[l] = near_t > t0[l] ? near_t : t0[l];
+			t1[l] = far_t < t1[l] ? far_t : t1[l];
+		}
+	}
+};
+
+#endif // !AABB_H
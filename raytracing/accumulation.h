@@ -0,0 +1,200 @@
+#ifndef ACCUMULATION_H
+#define ACCUMULATION_H
+
+#include "aov.h"
+#include "color.h"
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Everything besides the pixel sums that a resumed render has to agree on.
+// The random state of a pass is derived from (seed, pass index, pixel), so seed and
+// passes_done are enough to restart the generators exactly where they stopped.
+struct checkpoint_header {
+	char magic[4] = { 'R', 'T', 'C', 'K' };
+	uint32_t version = 3;
+	int32_t width = 0;
+	int32_t height = 0;
+	uint64_t seed = 0;
+	int32_t samples_per_pass = 0;
+	int32_t passes_done = 0;
+	uint32_t sampler = 0; // sampler_type; the sequences of two samplers do not mix
+	int32_t features = 0; // the AOV sums follow the pixel sums
+};
+
+inline float luminance(const color& c) {
+	return 0.2126f * c.x() + 0.7152f * c.y() + 0.0722f * c.z();
+}
+
+// Standard error of the mean luminance of n samples, scaled by the square root of the
+// mean: the display gamma compresses errors in bright pixels, so those may stop sooner.
+// The small floor on the mean keeps near black pixels from sampling forever.
+inline float relative_error(const color& sum, float sum_sq, int n) {
+	if (n < 2) return infinity;
+
+	float mean = luminance(sum) / n;
+	float variance = fmax(0.f, (sum_sq - mean * mean * n) / (n - 1));
+	return sqrt(variance / n) / sqrt(mean + 0.001f);
+}
+
+// Running per-pixel sums of radiance samples, kept across progressive passes.
+// The squared luminance sums give the sample variance used by adaptive sampling.
+class accumulation_buffer {
+public:
+	int width = 0;
+	int height = 0;
+	std::vector<color> sum;
+	std::vector<float> sum_sq;
+	std::vector<int> count;
+
+	accumulation_buffer(int w, int h)
+		: width(w), height(h), sum(static_cast<size_t>(w) * h), sum_sq(static_cast<size_t>(w) * h, 0.f),
+		count(static_cast<size_t>(w) * h, 0) {}
+
+	void add(int i, int j, const color& samples, float samples_sq, int n) {
+		size_t k = static_cast<size_t>(j) * width + i;
+		sum[k] += samples;
+		sum_sq[k] += samples_sq;
+		count[k] += n;
+	}
+
+	// total number of samples taken over the whole image
+	long long total_samples() const {
+		long long total = 0;
+		for (int n : count) total += n;
+		return total;
+	}
+
+	// Mark the pixels that still need samples: fewer than min_samples so far, or an error
+	// above the threshold anywhere in their 3x3 neighbourhood. Looking at the neighbours
+	// guards against pixels whose few samples happened to underestimate the variance.
+	// Returns false once every pixel has converged.
+	bool update_active(std::vector<unsigned char>& active, float threshold, int min_samples) const {
+		std::vector<float> error(sum.size());
+		for (size_t k = 0; k < sum.size(); k++)
+			error[k] = relative_error(sum[k], sum_sq[k], count[k]);
+
+		bool any = false;
+		for (int j = 0; j < height; j++) {
+			for (int i = 0; i < width; i++) {
+				size_t k = static_cast<size_t>(j) * width + i;
+				float worst = 0;
+				for (int y = std::max(0, j - 1); y <= std::min(height - 1, j + 1); y++)
+					for (int x = std::max(0, i - 1); x <= std::min(width - 1, i + 1); x++)
+						worst = std::max(worst, error[static_cast<size_t>(y) * width + x]);
+
+				active[k] = count[k] < min_samples || worst >= threshold;
+				any = any || active[k];
+			}
+		}
+		return any;
+	}
+
+	// average of everything accumulated so far
+	void resolve(framebuffer& image) const {
+		for (size_t k = 0; k < sum.size(); k++)
+			image.pixels[k] = count[k] > 0 ? sum[k] / static_cast<float>(count[k]) : color(0, 0, 0);
+	}
+
+	// Variance of every pixel's mean luminance, the noise left in the resolved image.
+	// Below two samples there is no estimate; the squared mean stands in for it.
+	void resolve_variance(std::vector<float>& variance) const {
+		variance.resize(sum.size());
+		for (size_t k = 0; k < sum.size(); k++) {
+			int n = count[k];
+			float mean = n > 0 ? luminance(sum[k]) / n : 0.f;
+			variance[k] = n < 2 ? mean * mean : fmax(0.f, (sum_sq[k] - mean * mean * n) / (n - 1)) / n;
+		}
+	}
+
+	// aov, when given, is saved along; header.features tells whether it was
+	bool save(const std::string& filename, checkpoint_header header, const aov_buffer* aov = nullptr) const {
+		header.width = width;
+		header.height = height;
+		header.features = aov ? 1 : 0;
+
+		// write next to the old snapshot first, so a kill mid-write never loses it
+		std::string temp = filename + ".tmp";
+		{
+			std::ofstream file(temp, std::ios::binary);
+			if (!file.is_open()) return false;
+			file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			std::vector<float> flat(sum.size() * 3);
+			for (size_t k = 0; k < sum.size(); k++)
+				for (int c = 0; c < 3; c++) flat[3 * k + c] = sum[k][c];
+			file.write(reinterpret_cast<const char*>(flat.data()), flat.size() * sizeof(float));
+			file.write(reinterpret_cast<const char*>(sum_sq.data()), sum_sq.size() * sizeof(float));
+			file.write(reinterpret_cast<const char*>(count.data()), count.size() * sizeof(int));
+			if (aov) {
+				// vec3 may be padded, the file holds three floats each
+				std::vector<float> features(aov->count.size() * 7);
+				for (size_t k = 0; k < aov->count.size(); k++) {
+					for (int c = 0; c < 3; c++) {
+						features[7 * k + c] = aov->normal[k][c];
+						features[7 * k + 3 + c] = aov->albedo[k][c];
+					}
+					features[7 * k + 6] = aov->depth[k];
+				}
+				file.write(reinterpret_cast<const char*>(features.data()), features.size() * sizeof(float));
+				file.write(reinterpret_cast<const char*>(aov->count.data()), aov->count.size() * sizeof(int));
+			}
+			if (!file.good()) return false;
+		}
+		std::remove(filename.c_str());
+		return std::rename(temp.c_str(), filename.c_str()) == 0;
+	}
+
+	// Restore the sums, and those of aov when given, if the snapshot matches this image and
+	// the expected settings. A snapshot of other settings is refused, the render starts over.
+	bool load(const std::string& filename, checkpoint_header& header, aov_buffer* aov = nullptr) {
+		std::ifstream file(filename, std::ios::binary);
+		if (!file.is_open()) return false;
+
+		checkpoint_header stored;
+		file.read(reinterpret_cast<char*>(&stored), sizeof(stored));
+		if (!file.good() || std::memcmp(stored.magic, header.magic, 4) != 0 || stored.version != header.version
+			|| stored.width != width || stored.height != height
+			|| stored.seed != header.seed || stored.samples_per_pass != header.samples_per_pass
+			|| stored.sampler != header.sampler || stored.features != (aov ? 1 : 0)) {
+			std::cerr << "Checkpoint " << filename << " was taken with other settings, starting over" << std::endl;
+			return false;
+		}
+
+		std::vector<float> flat(sum.size() * 3);
+		std::vector<float> stored_sq(sum_sq.size());
+		std::vector<int> stored_count(count.size());
+		file.read(reinterpret_cast<char*>(flat.data()), flat.size() * sizeof(float));
+		file.read(reinterpret_cast<char*>(stored_sq.data()), stored_sq.size() * sizeof(float));
+		file.read(reinterpret_cast<char*>(stored_count.data()), stored_count.size() * sizeof(int));
+		std::vector<float> features(aov ? aov->count.size() * 7 : 0);
+		std::vector<int> feature_count(aov ? aov->count.size() : 0);
+		file.read(reinterpret_cast<char*>(features.data()), features.size() * sizeof(float));
+		file.read(reinterpret_cast<char*>(feature_count.data()), feature_count.size() * sizeof(int));
+		if (!file.good()) return false;
+
+		if (aov) {
+			for (size_t k = 0; k < feature_count.size(); k++) {
+				aov->normal[k] = vec3(features[7 * k], features[7 * k + 1], features[7 * k + 2]);
+				aov->albedo[k] = color(features[7 * k + 3], features[7 * k + 4], features[7 * k + 5]);
+				aov->depth[k] = features[7 * k + 6];
+			}
+			aov->count.swap(feature_count);
+		}
+
+		for (size_t k = 0; k < sum.size(); k++)
+			sum[k] = color(flat[3 * k], flat[3 * k + 1], flat[3 * k + 2]);
+		sum_sq.swap(stored_sq);
+		count.swap(stored_count);
+		header = stored;
+		return true;
+	}
+};
+
+#endif // !ACCUMULATION_H
@@ -0,0 +1,126 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "instance.h"
+#include "material.h"
+#include "thread_pool.h"
+#include "time.h"
+#include "transform.h"
+
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// What changes from one frame to the next
+struct animation_frame {
+	point3 lookfrom;
+	point3 lookat;
+	std::vector<transform> transforms; // one per animated instance
+};
+
+// image.ppm -> image_0007.ppm
+inline std::string frame_filename(const std::string& filename, int frame) {
+	char number[16];
+	std::snprintf(number, sizeof(number), "_%04d", frame);
+	size_t dot = filename.find_last_of('.');
+	size_t slash = filename.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return filename + number;
+	return filename.substr(0, dot) + number + filename.substr(dot);
+}
+
+// Renders a numbered image sequence of one scene. Between frames only the camera pose
+// and the transforms of the animated instances change: the world is refit, not rebuilt,
+// and the thread pool lives for the whole sequence. While frame N renders, the setup of
+// frame N + 1 runs on its own thread and frame N - 1 is written to disk. With RT_STATS
+// every frame gets its own stats file next to its image.
+class animation {
+public:
+	int frame_count = 1;
+	std::vector<shared_ptr<instance>> animated; // instances the frames move, must be part of the world
+
+	// Fill in the state of a frame, starting from a copy of the previous one. Runs next to
+	// the render of the previous frame, so it must not touch the world or the camera.
+	std::function<void(int frame, animation_frame& state)> setup;
+
+	void render(camera& cam, hittable& world, const material_list& materials) {
+		timer time;
+		thread_pool pool(cam.thread_count);
+
+		animation_frame current;
+		current.lookfrom = cam.lookfrom;
+		current.lookat = cam.lookat;
+		for (const auto& object : animated)
+			current.transforms.push_back(object->get_transform());
+		animation_frame next = current;
+
+		if (setup) {
+			setup(0, current);
+			apply(current, cam, world);
+		}
+
+		framebuffer image, finished;
+		std::future<bool> writing;
+		std::future<void> preparing;
+
+		for (int frame = 0; frame < frame_count; frame++) {
+			if (setup && frame + 1 < frame_count) {
+				next = current;
+				preparing = std::async(std::launch::async, [this, frame, &next]() { setup(frame + 1, next); });
+			}
+
+#if defined(RT_STATS)
+			timer frame_time;
+#endif
+			cam.render_frame(world, materials, pool, image);
+#if defined(RT_STATS)
+			double frame_seconds = frame_time.duration();
+#endif
+
+			// hand the image to the writer once it is done with the previous one
+			if (writing.valid() && !writing.get())
+				std::cout << "File write error" << std::endl;
+			std::swap(finished, image);
+			std::string filename = frame_filename(cam.output_file, frame);
+			writing = std::async(std::launch::async, [&finished, filename]() { return finished.write(filename); });
+#if defined(RT_STATS)
+			// image_0007.ppm -> image_0007.stats.json, counters of this frame only
+			if (!write_stats(stats_filename(filename), cam.worker_statistics(), frame_seconds))
+				std::cout << "Stats write error" << std::endl;
+#endif
+
+			if (preparing.valid()) {
+				preparing.get();
+				std::swap(current, next);
+				apply(current, cam, world);
+			}
+
+			std::clog << "\rFrame " << frame + 1 << "/" << frame_count << " done" << std::flush;
+		}
+
+		if (writing.valid() && !writing.get())
+			std::cout << "File write error" << std::endl;
+
+		std::clog << "\nCompleted " << frame_count << " frames, ran for " << time.duration() << " seconds" << std::endl;
+	}
+
+private:
+	void apply(const animation_frame& state, camera& cam, hittable& world) const {
+		cam.lookfrom = state.lookfrom;
+		cam.lookat = state.lookat;
+		for (size_t k = 0; k < animated.size() && k < state.transforms.size(); k++)
+			animated[k]->set_transform(state.transforms[k]);
+		if (!animated.empty())
+			world.refit();
+	}
+};
+
+#endif // !ANIMATION_H
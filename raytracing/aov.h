@@ -0,0 +1,81 @@
+#ifndef AOV_H
+#define AOV_H
+
+#include "color.h"
+#include "framebuffer.h"
+#include "stats.h"
+
+#include <string>
+#include <vector>
+
+// What one camera sample saw besides radiance: the guides of the denoiser. Depth is the
+// distance to the first hit, normal and albedo belong to the first diffuse or emitting
+// surface, looking through mirrors and glass so their reflections keep sharp edges.
+// Samples that miss, or end on specular surfaces only, keep the defaults: no normal, a
+// white albedo and depth 0.
+struct aov_sample {
+	vec3 normal = vec3(0, 0, 0);
+	color albedo = color(1.f, 1.f, 1.f);
+	float depth = 0;
+	bool done = false; // normal and albedo are final
+};
+
+// Per-pixel sums of the aov_samples of every pass, filled tile by tile like the
+// accumulation_buffer.
+class aov_buffer {
+public:
+	int width = 0;
+	int height = 0;
+	std::vector<vec3> normal;
+	std::vector<color> albedo;
+	std::vector<float> depth;
+	std::vector<int> count;
+
+	aov_buffer(int w, int h)
+		: width(w), height(h), normal(static_cast<size_t>(w) * h), albedo(static_cast<size_t>(w) * h),
+		depth(static_cast<size_t>(w) * h, 0.f), count(static_cast<size_t>(w) * h, 0) {}
+
+	void add(int i, int j, const aov_sample& s) {
+		size_t k = static_cast<size_t>(j) * width + i;
+		normal[k] += s.normal;
+		albedo[k] += s.albedo;
+		depth[k] += s.depth;
+		count[k]++;
+	}
+
+	// pixel averages; normals are renormalized, silhouette pixels get their mean direction
+	vec3 mean_normal(size_t k) const {
+		float length = normal[k].length();
+		return length > 0 ? normal[k] / length : vec3(0, 0, 0);
+	}
+
+	color mean_albedo(size_t k) const {
+		return count[k] > 0 ? albedo[k] / static_cast<float>(count[k]) : color(1.f, 1.f, 1.f);
+	}
+
+	float mean_depth(size_t k) const {
+		return count[k] > 0 ? depth[k] / count[k] : 0.f;
+	}
+
+	// image.ppm -> image.normal.pfm, image.albedo.pfm, image.depth.pfm and image.variance.pfm,
+	// linear floats; variance is that of each pixel's mean luminance
+	bool write(const std::string& image_file, const std::vector<float>& variance) const {
+		framebuffer normals(width, height), albedos(width, height), depths(width, height), variances(width, height);
+		for (size_t k = 0; k < count.size(); k++) {
+			normals.pixels[k] = mean_normal(k);
+			albedos.pixels[k] = mean_albedo(k);
+			float d = mean_depth(k);
+			depths.pixels[k] = color(d, d, d);
+			variances.pixels[k] = color(variance[k], variance[k], variance[k]);
+		}
+
+		std::string stem = file_stem(image_file);
+		bool ok = normals.write(stem + ".normal.pfm");
+		ok = albedos.write(stem + ".albedo.pfm") && ok;
+		ok = depths.write(stem + ".depth.pfm") && ok;
+		ok = variances.write(stem + ".variance.pfm") && ok;
+		return ok;
+	}
+};
+
+#endif // !AOV_H
@@ -0,0 +1,123 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Monotonic allocator for the objects of a scene. Objects are constructed one after the
+// other in large blocks, never move and are never freed on their own: all of them are
+// destroyed, and the blocks freed, at once. Handles from make are shared_ptrs that share
+// the single reference count of the arena's storage instead of owning their object, so
+// they fit hittable_list and the BVHs as they are, and the storage lives as long as the
+// arena or any object of it is still referenced. Objects in the arena must not hold
+// handles of it themselves, or the storage keeps itself alive and is never freed.
+class scene_arena {
+public:
+	explicit scene_arena(size_t block_size = 1 << 20) : store(std::make_shared<storage>(block_size)) {}
+
+	// construct a T in the arena, alive until the storage goes
+	template <typename T, typename... Args>
+	T* create(Args&&... args) {
+		return store->template create<T>(std::forward<Args>(args)...);
+	}
+
+	// create, as a handle that keeps the storage alive
+	template <typename T, typename... Args>
+	std::shared_ptr<T> make(Args&&... args) {
+		return std::shared_ptr<T>(store, create<T>(std::forward<Args>(args)...));
+	}
+
+	// destroy every object, newest first, and free the blocks; handles still around dangle
+	void release() { store->release(); }
+
+	// bytes of the blocks taken from the heap
+	size_t reserved() const { return store->reserved(); }
+
+	// storages of all arenas not yet freed, 0 once every scene is gone
+	static size_t live_storage() { return storage::live(); }
+
+private:
+	class storage {
+	public:
+		explicit storage(size_t _block_size) : block_size(_block_size) { live()++; }
+		storage(const storage&) = delete;
+		storage& operator=(const storage&) = delete;
+		~storage() {
+			release();
+			live()--;
+		}
+
+		static std::atomic<size_t>& live() {
+			static std::atomic<size_t> count(0);
+			return count;
+		}
+
+		template <typename T, typename... Args>
+		T* create(Args&&... args) {
+			T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+			// the record goes into the block too, next to its object, no list to grow
+			if (!std::is_trivially_destructible<T>::value)
+				last = new (allocate(sizeof(cleanup), alignof(cleanup)))
+					cleanup{ last, object, [](void* p) { static_cast<T*>(p)->~T(); } };
+			return object;
+		}
+
+		void release() {
+			for (; last; last = last->previous)
+				last->destroy(last->object);
+			blocks.clear();
+			used = capacity = 0;
+		}
+
+		size_t reserved() const {
+			size_t total = 0;
+			for (const auto& block : blocks) total += block.size;
+			return total;
+		}
+
+	private:
+		struct block {
+			std::unique_ptr<unsigned char[]> bytes;
+			size_t size;
+		};
+		struct cleanup {
+			cleanup* previous;
+			void* object;
+			void (*destroy)(void*);
+		};
+
+		size_t block_size;
+		std::vector<block> blocks;
+		cleanup* last = nullptr; // newest object to destroy
+		size_t used = 0; // bytes taken of the last block
+		size_t capacity = 0; // bytes of the last block
+
+		void* allocate(size_t size, size_t alignment) {
+			size_t offset = 0;
+			if (!blocks.empty()) {
+				uintptr_t base = reinterpret_cast<uintptr_t>(blocks.back().bytes.get());
+				offset = ((base + used + alignment - 1) & ~(alignment - 1)) - base;
+			}
+			if (blocks.empty() || offset + size > capacity) {
+				// objects larger than a block get one of their own
+				capacity = std::max(block_size, size + alignment);
+				blocks.push_back({ std::unique_ptr<unsigned char[]>(new unsigned char[capacity]), capacity });
+				uintptr_t base = reinterpret_cast<uintptr_t>(blocks.back().bytes.get());
+				offset = ((base + alignment - 1) & ~(alignment - 1)) - base;
+			}
+			used = offset + size;
+			return blocks.back().bytes.get() + offset;
+		}
+	};
+
+	std::shared_ptr<storage> store;
+};
+
+#endif // !ARENA_H
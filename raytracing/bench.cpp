@@ -0,0 +1,437 @@
+#include "rtweekend.h"
+#include "arena.h"
+#include "bvh.h"
+#include "camera.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "mesh.h"
+#include "scene.h"
+#include "sphere.h"
+#include "sphere_soup.h"
+#include "time.h"
+#include "wide_bvh.h"
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+// Micro-benchmark of the vec3 hot path: normalize, dot, cross and reflect per ray,
+// the operations camera, sphere and material lean on. Build once with and once
+// without RT_VEC3_SIMD to compare the backends.
+static double vec3_ns_per_ray(int ray_count, int repeats) {
+	std::vector<point3> origins(ray_count);
+	std::vector<vec3> directions(ray_count);
+	seed_random(1);
+	for (int k = 0; k < ray_count; k++) {
+		origins[k] = vec3::random(-10, 10);
+		directions[k] = vec3::random(-1, 1);
+	}
+
+	const point3 center(0, 0, -5);
+	const float radius = 2.f;
+
+	float checksum = 0;
+	timer time;
+	for (int rep = 0; rep < repeats; rep++) {
+		for (int k = 0; k < ray_count; k++) {
+			vec3 d = unit_vector(directions[k]);
+
+			// sphere test as in sphere::hit
+			vec3 oc = origins[k] - center;
+			auto half_b = dot(d, oc);
+			auto c = dot(oc, oc) - radius * radius;
+			auto discriminant = half_b * half_b - c;
+			auto t = discriminant < 0 ? 1.f : -half_b - sqrt(discriminant);
+
+			// shading frame and mirror bounce as in the materials
+			point3 p = origins[k] + t * d;
+			vec3 n = unit_vector(p - center);
+			vec3 tangent = unit_vector(cross(fabs(n.x()) > 0.9f ? vec3(0, 1, 0) : vec3(1, 0, 0), n));
+			vec3 bitangent = cross(n, tangent);
+			vec3 r = reflect(d, n) + 0.1f * (tangent + bitangent);
+
+			checksum += r.x() + r.y() + r.z();
+		}
+	}
+	double seconds = time.duration();
+
+	// keep the loop from being optimized away
+	if (checksum == 12345.f) std::clog << checksum;
+
+	return seconds * 1e9 / (static_cast<double>(ray_count) * repeats);
+}
+
+// Micro-benchmark of closest hit queries against sphere_count random spheres, with every
+// sphere tested: a hittable_list of sphere against one sphere_soup, whose batches go
+// through SIMD. Both see the same rays; hits counts what each found, which agree unless
+// the compiler contracts sphere::hit into FMAs.
+static void spheres_ns_per_ray(int sphere_count, int ray_count, double& list_ns, double& soup_ns,
+	int& list_hits, int& soup_hits) {
+	seed_random(3);
+	hittable_list list;
+	sphere_soup soup;
+	soup.reserve(sphere_count);
+	for (int k = 0; k < sphere_count; k++) {
+		point3 center = vec3::random(-20, 20);
+		float radius = random_float(0.05f, 0.5f);
+		list.add(make_shared<sphere>(center, radius, 0));
+		soup.add(center, radius, 0);
+	}
+
+	std::vector<ray> rays(ray_count);
+	for (auto& r : rays)
+		r = ray(vec3::random(-25, 25), unit_vector(vec3::random(-1, 1)));
+
+	auto time_queries = [&](const hittable& world, int& hits) {
+		hits = 0;
+		hit_record rec;
+		timer time;
+		for (const auto& r : rays)
+			hits += world.hit(r, interval(0.001f, infinity), rec) ? 1 : 0;
+		return time.duration() * 1e9 / ray_count;
+	};
+	list_ns = time_queries(list, list_hits);
+	soup_ns = time_queries(soup, soup_hits);
+}
+
+// Micro-benchmark of scene construction: a million spheres put into a hittable_list and
+// freed again, each sphere from its own make_shared or all from one scene_arena.
+static void scene_build_ms(int sphere_count, bool use_arena, double& build_ms, double& free_ms) {
+	timer build_time;
+	scene_arena arena;
+	hittable_list world;
+	world.objects.reserve(sphere_count);
+	for (int k = 0; k < sphere_count; k++) {
+		point3 center(static_cast<float>(k % 1000), 0.f, static_cast<float>(k / 1000));
+		if (use_arena)
+			world.add(arena.make<sphere>(center, 0.4f, 0));
+		else
+			world.add(make_shared<sphere>(center, 0.4f, 0));
+	}
+	build_ms = build_time.duration() * 1e3;
+
+	timer free_time;
+	world.clear();
+	arena = scene_arena();
+	free_ms = free_time.duration() * 1e3;
+}
+
+// A scene with a mesh and an instance of it, built as a scene file is and dropped again:
+// true if its arena went with it.
+static bool instanced_scene_released() {
+	scene_description desc;
+	desc.materials.push_back({ static_cast<uint32_t>(material_type::lambertian), { 0.5f, 0.5f, 0.5f }, 0.f, 0.f });
+	desc.meshes.push_back({ 3, 3, 0 });
+	desc.vertices = { 0, 0, 0, 1, 0, 0, 0, 1, 0 };
+	desc.indices = { 0, 1, 2 };
+	desc.instances.push_back({ 0, instance::keep_material, { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } } });
+
+	size_t before = scene_arena::live_storage();
+	{
+		hittable_list world, lights;
+		material_list materials;
+		camera cam;
+		if (!build_scene(desc, world, lights, materials, cam))
+			return false;
+	}
+	return scene_arena::live_storage() == before;
+}
+
+// Canonical scenes: fixed content, seeds, resolution and sample counts, so runs of
+// different builds trace exactly the same rays and the numbers can be compared.
+struct bench_scene {
+	const char* name;
+	void (*build)(scene_arena& arena, hittable_list& world, material_list& materials, camera& cam);
+	int width;
+	int samples_per_pixel;
+	int max_depth;
+};
+
+static void look_at_cover(camera& cam) {
+	cam.aspect_ratio = 16.f / 9.f;
+	cam.vfov = 20;
+	cam.lookfrom = point3(13, 2, 3);
+	cam.lookat = point3(0, 0, 0);
+	cam.defocus_angle = .1f;
+	cam.focus_dist = 10.f;
+}
+
+// the scene of main.cpp
+static void cover_scene(scene_arena& arena, hittable_list& world, material_list& materials, camera& cam) {
+	world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, materials.add(lambertian(color(0.5, 0.5, 0.5)))));
+
+	for (int a = -11; a < 11; a++) {
+		for (int b = -11; b < 11; b++) {
+			auto choose_mat = random_float();
+			point3 center(a + 0.9 * random_float(), 0.2, b + 0.9 * random_float());
+			if ((center - point3(4, 0.2, 0)).length() <= 0.9) continue;
+
+			uint32_t sphere_material;
+			if (choose_mat < 0.75)
+				sphere_material = materials.add(lambertian(color::random() * color::random()));
+			else if (choose_mat < 0.90)
+				sphere_material = materials.add(metal(color::random(0.5, 1), random_float(0, 0.5)));
+			else
+				sphere_material = materials.add(dielectric(1.5));
+			world.add(arena.make<sphere>(center, 0.2, sphere_material));
+		}
+	}
+
+	world.add(arena.make<sphere>(point3(0, 1, 0), 1.0, materials.add(dielectric(2.5f))));
+	world.add(arena.make<sphere>(point3(-4, 1, 0), 1.0, materials.add(lambertian(color(0.4, 0.2, 0.1)))));
+	world.add(arena.make<sphere>(point3(4, 1, 0), 1.0, materials.add(metal(color(0.7, 0.6, 0.5), 0.0))));
+
+	look_at_cover(cam);
+}
+
+// long refraction chains: solid and hollow glass balls in front of a few diffuse ones
+static void glass_scene(scene_arena& arena, hittable_list& world, material_list& materials, camera& cam) {
+	world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, materials.add(lambertian(color(0.5, 0.5, 0.5)))));
+
+	auto glass = materials.add(dielectric(1.5f));
+	for (int a = -5; a <= 5; a++) {
+		for (int b = -5; b <= 5; b++) {
+			point3 center(a * 0.9f, 0.35f, b * 0.9f);
+			world.add(arena.make<sphere>(center, 0.35f, glass));
+			// every other ball is a bubble
+			if ((a + b) % 2 == 0)
+				world.add(arena.make<sphere>(center, -0.3f, glass));
+		}
+	}
+
+	world.add(arena.make<sphere>(point3(0, 1, 0), 1.0, glass));
+	world.add(arena.make<sphere>(point3(-4, 1, 0), 1.0, materials.add(lambertian(color(0.4, 0.2, 0.1)))));
+	world.add(arena.make<sphere>(point3(4, 1, 0), 1.0, materials.add(lambertian(color(0.1, 0.2, 0.5)))));
+
+	look_at_cover(cam);
+}
+
+// 100k small spheres in a slab above the ground, stresses BVH build and traversal
+static void spheres_scene(scene_arena& arena, hittable_list& world, material_list& materials, camera& cam) {
+	world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, materials.add(lambertian(color(0.5, 0.5, 0.5)))));
+
+	uint32_t palette[8];
+	for (int k = 0; k < 6; k++)
+		palette[k] = materials.add(lambertian(color::random() * color::random()));
+	palette[6] = materials.add(metal(color(0.8, 0.8, 0.8), 0.1f));
+	palette[7] = materials.add(dielectric(1.5f));
+
+	for (int k = 0; k < 100000; k++) {
+		point3 center(random_float(-20, 20), random_float(0.05f, 3), random_float(-20, 20));
+		world.add(arena.make<sphere>(center, 0.05f, palette[static_cast<int>(random_float() * 8)]));
+	}
+
+	look_at_cover(cam);
+	cam.lookfrom = point3(26, 6, 6);
+	cam.focus_dist = 26.f;
+}
+
+// a torus of 128k triangles standing on the ground
+static void mesh_scene(scene_arena& arena, hittable_list& world, material_list& materials, camera& cam) {
+	world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, materials.add(lambertian(color(0.5, 0.5, 0.5)))));
+
+	const int rings = 512, sides = 128;
+	const float major = 1.5f, minor = 0.5f;
+	std::vector<point3> vertices;
+	std::vector<uint32_t> indices;
+	for (int r = 0; r < rings; r++) {
+		float u = 2 * pi * r / rings;
+		for (int s = 0; s < sides; s++) {
+			float v = 2 * pi * s / sides;
+			float d = major + minor * cos(v);
+			vertices.push_back(point3(d * cos(u), 2.f + d * sin(u), minor * sin(v)));
+		}
+	}
+	for (int r = 0; r < rings; r++) {
+		for (int s = 0; s < sides; s++) {
+			uint32_t a = r * sides + s, b = ((r + 1) % rings) * sides + s;
+			uint32_t c = ((r + 1) % rings) * sides + (s + 1) % sides, d = r * sides + (s + 1) % sides;
+			indices.insert(indices.end(), { a, b, c, a, c, d });
+		}
+	}
+	world.add(arena.make<triangle_mesh>(std::move(vertices), std::move(indices), materials.add(metal(color(0.8, 0.6, 0.2), 0.2f))));
+	world.add(arena.make<sphere>(point3(0, 2, 0), 0.6f, materials.add(lambertian(color(0.1, 0.2, 0.5)))));
+
+	look_at_cover(cam);
+	cam.lookat = point3(0, 1.5f, 0);
+	cam.focus_dist = 13.f;
+}
+
+static const bench_scene scenes[] = {
+	{ "cover", cover_scene, 400, 32, 50 },
+	{ "glass", glass_scene, 400, 32, 50 },
+	{ "spheres100k", spheres_scene, 400, 8, 50 },
+	{ "mesh", mesh_scene, 400, 32, 50 },
+};
+
+// high water mark of the process memory in MiB
+static double peak_rss_mb() {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024.0; // kilobytes on Linux
+#endif
+}
+
+// The scene as seen by a second, untimed render of a benchmark: it counts every ray traced
+// against it, shadow rays included. Seeds are fixed, so the count is that of the timed
+// render, which runs without counters in its hot loop.
+class ray_counter : public hittable {
+public:
+	explicit ray_counter(const hittable& _world) : world(_world) {}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		rays.fetch_add(1, std::memory_order_relaxed);
+		return world.hit(r, ray_t, rec);
+	}
+
+	unsigned int hit_packet(ray_packet& packet, unsigned int mask, hit_record* rec) const override {
+		uint64_t lanes = 0;
+		for (unsigned int m = mask; m; m &= m - 1) lanes++;
+		rays.fetch_add(lanes, std::memory_order_relaxed);
+		return world.hit_packet(packet, mask, rec);
+	}
+
+	aabb bounding_box() const override { return world.bounding_box(); }
+
+	uint64_t count() const { return rays.load(); }
+
+private:
+	const hittable& world;
+	mutable std::atomic<uint64_t> rays{ 0 };
+};
+
+// Render one scene and print its results as a single line of JSON; a second render counts
+// the rays
+static void run_scene(const bench_scene& scene, int thread_count, bvh_layout layout, const std::string& layout_name) {
+	seed_random(2024);
+
+	timer build_time;
+	scene_arena arena;
+	hittable_list world;
+	material_list materials;
+	camera cam;
+	scene.build(arena, world, materials, cam);
+	world = hittable_list(make_bvh(world, layout));
+	double build_seconds = build_time.duration();
+
+	cam.image_width = scene.width;
+	cam.samples_per_pixel = scene.samples_per_pixel;
+	cam.samples_per_pass = scene.samples_per_pixel / 4;
+	cam.max_depth = scene.max_depth;
+	cam.seed = 1;
+	cam.thread_count = thread_count;
+	cam.output_file = std::string("bench_") + scene.name + ".ppm";
+
+	timer render_time;
+	cam.render(world, materials);
+	double render_seconds = render_time.duration();
+
+	double trace_seconds = 0;
+	for (double s : cam.pass_seconds()) trace_seconds += s;
+	std::vector<double> pass_seconds = cam.pass_seconds();
+
+	ray_counter counter(world);
+	cam.render(counter, materials);
+	uint64_t rays = counter.count();
+	// the thread_pool default
+	int threads = thread_count > 0 ? thread_count : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+	std::cout << "{\"scene\": \"" << scene.name << "\", \"bvh\": \"" << layout_name << "\", \"width\": " << cam.image_width
+		<< ", \"spp\": " << cam.samples_per_pixel << ", \"threads\": " << threads
+		<< ", \"build_seconds\": " << build_seconds << ", \"render_seconds\": " << render_seconds
+		<< ", \"pass_seconds\": [";
+	for (size_t p = 0; p < pass_seconds.size(); p++)
+		std::cout << (p ? ", " : "") << pass_seconds[p];
+	std::cout << "], \"rays\": " << rays
+		<< ", \"mrays_per_second\": " << rays / trace_seconds * 1e-6
+		<< ", \"peak_rss_mb\": " << peak_rss_mb() << "}" << std::endl;
+}
+
+// raytracing_bench [--threads n] [--bvh binary|bvh4|bvh8] [scene...]
+// Without scene names every scene runs, plus the vec3, sphere_soup and scene construction
+// micro-benchmarks. --bvh picks the node layout of the world BVH. Peak RSS covers the
+// whole process, so run scenes one per process to get the memory of each on its own.
+int main(int argc, char** argv) {
+	int thread_count = 0;
+	std::string layout_name = "binary";
+	bvh_layout layout = bvh_layout::binary;
+	std::vector<std::string> names;
+	for (int k = 1; k < argc; k++) {
+		if (std::strcmp(argv[k], "--threads") == 0 && k + 1 < argc)
+			thread_count = std::atoi(argv[++k]);
+		else if (std::strcmp(argv[k], "--bvh") == 0 && k + 1 < argc) {
+			layout_name = argv[++k];
+			if (!parse_bvh_layout(layout_name, layout)) {
+				std::cout << "Unknown BVH layout " << layout_name << std::endl;
+				return 1;
+			}
+		}
+		else
+			names.push_back(argv[k]);
+	}
+
+	if (names.empty()) {
+#if defined(RT_VEC3_SIMD)
+		const char* backend = "sse";
+#else
+		const char* backend = "scalar";
+#endif
+		std::cout << "{\"scene\": \"vec3\", \"backend\": \"" << backend << "\", \"ns_per_ray\": "
+			<< vec3_ns_per_ray(1 << 16, 200) << "}" << std::endl;
+
+		for (int sphere_count : { 1000, 10000 }) {
+			double list_ns, soup_ns;
+			int list_hits, soup_hits;
+			spheres_ns_per_ray(sphere_count, 20000, list_ns, soup_ns, list_hits, soup_hits);
+			std::cout << "{\"scene\": \"soup\", \"spheres\": " << sphere_count << ", \"lanes\": " << sphere_soup::lanes
+				<< ", \"hittable_list_ns_per_ray\": " << list_ns << ", \"sphere_soup_ns_per_ray\": " << soup_ns
+				<< ", \"speedup\": " << list_ns / soup_ns << ", \"hittable_list_hits\": " << list_hits
+				<< ", \"sphere_soup_hits\": " << soup_hits << "}" << std::endl;
+		}
+
+		for (int use_arena = 0; use_arena < 2; use_arena++) {
+			double build_ms, free_ms;
+			scene_build_ms(1000000, use_arena != 0, build_ms, free_ms);
+			std::cout << "{\"scene\": \"build1m\", \"allocator\": \"" << (use_arena ? "arena" : "make_shared")
+				<< "\", \"build_ms\": " << build_ms << ", \"free_ms\": " << free_ms << "}" << std::endl;
+		}
+
+		if (!instanced_scene_released()) {
+			std::cerr << "The arena of an instanced scene was not freed" << std::endl;
+			return 1;
+		}
+	}
+
+	for (const auto& scene : scenes) {
+		bool selected = names.empty();
+		for (const auto& name : names) selected = selected || name == scene.name;
+		if (selected) {
+			run_scene(scene, thread_count, layout, layout_name);
+			if (scene_arena::live_storage() != 0) {
+				std::cerr << "The arena of scene " << scene.name << " was not freed" << std::endl;
+				return 1;
+			}
+		}
+	}
+}
@@ -0,0 +1,178 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <vector>
+
+// Bounds of one primitive as seen by the BVH builder
+struct bvh_primitive {
+	aabb box;
+	point3 centroid;
+	int index; // position of the primitive in the caller's array
+};
+
+// Reorder prims[start, end) around the cheapest split under the surface area heuristic
+// and return the split position. Centroids are binned along every axis, and the split
+// minimizing area(left) * count(left) + area(right) * count(right) wins.
+inline size_t sah_partition(std::vector<bvh_primitive>& prims, size_t start, size_t end) {
+	const int bin_count = 16;
+
+	aabb centroid_bounds;
+	for (size_t i = start; i < end; i++)
+		centroid_bounds = aabb(centroid_bounds, aabb(prims[i].centroid, prims[i].centroid));
+
+	float best_cost = infinity;
+	int best_axis = -1;
+	int best_split = 0;
+
+	for (int axis = 0; axis < 3; axis++) {
+		auto extent = centroid_bounds.axis(axis);
+		if (extent.size() <= 0) continue;
+
+		aabb bins[bin_count];
+		int counts[bin_count] = {};
+		float scale = bin_count / extent.size();
+
+		for (size_t i = start; i < end; i++) {
+			int b = std::min(bin_count - 1, static_cast<int>((prims[i].centroid[axis] - extent.min) * scale));
+			bins[b] = aabb(bins[b], prims[i].box);
+			counts[b]++;
+		}
+
+		// sweep from the right to collect the cost of every right-hand side
+		float right_area[bin_count];
+		int right_count[bin_count];
+		aabb right_box;
+		int right_n = 0;
+		for (int b = bin_count - 1; b > 0; b--) {
+			right_box = aabb(right_box, bins[b]);
+			right_n += counts[b];
+			right_area[b] = right_box.surface_area();
+			right_count[b] = right_n;
+		}
+
+		aabb left_box;
+		int left_n = 0;
+		for (int b = 1; b < bin_count; b++) {
+			left_box = aabb(left_box, bins[b - 1]);
+			left_n += counts[b - 1];
+			if (left_n == 0 || right_count[b] == 0) continue;
+
+			float cost = left_box.surface_area() * left_n + right_area[b] * right_count[b];
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_split = b;
+			}
+		}
+	}
+
+	// all centroids coincide: any split is as good as another, cut in the middle
+	if (best_axis < 0) {
+		size_t mid = start + (end - start) / 2;
+		std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+			[](const bvh_primitive& a, const bvh_primitive& b) { return a.index < b.index; });
+		return mid;
+	}
+
+	auto extent = centroid_bounds.axis(best_axis);
+	float scale = bin_count / extent.size();
+	auto it = std::partition(prims.begin() + start, prims.begin() + end, [&](const bvh_primitive& p) {
+		int b = std::min(bin_count - 1, static_cast<int>((p.centroid[best_axis] - extent.min) * scale));
+		return b < best_split;
+	});
+	return static_cast<size_t>(it - prims.begin());
+}
+
+class bvh_node : public hittable {
+public:
+	bvh_node(const hittable_list& list) : bvh_node(list.objects) {}
+
+	bvh_node(const std::vector<shared_ptr<hittable>>& objects) {
+		// the builder only ever looks at the bounds, so query them once up front
+		std::vector<bvh_primitive> prims(objects.size());
+		for (size_t i = 0; i < objects.size(); i++) {
+			prims[i].box = objects[i]->bounding_box();
+			prims[i].centroid = prims[i].box.centroid();
+			prims[i].index = static_cast<int>(i);
+		}
+
+		build(objects, prims, 0, prims.size());
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		RT_STATS_ADD(bvh_node_visits, 1);
+		if (!bbox.hit(r, ray_t))
+			return false;
+
+		bool hit_left = left->hit(r, ray_t, rec);
+		// the right child only has to beat the closest hit of the left one
+		bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+
+		return hit_left || hit_right;
+	}
+
+	unsigned int hit_packet(ray_packet& packet, unsigned int mask, hit_record* rec) const override {
+		RT_STATS_ADD(bvh_node_visits, 1);
+		// only the lanes that enter this box go further down
+		mask = bbox.hit_packet(packet, mask);
+		if (!mask)
+			return 0;
+
+		unsigned int hits = left->hit_packet(packet, mask, rec);
+		hits |= right->hit_packet(packet, mask, rec);
+		return hits;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	// Bottom up box update for moved instances. Far cheaper than a rebuild, but the
+	// splits stay those of the first layout, so large motions slowly degrade the tree.
+	void refit() override {
+		if (!left) return;
+		left->refit();
+		if (right != left)
+			right->refit();
+		bbox = aabb(left->bounding_box(), right->bounding_box());
+	}
+
+private:
+	shared_ptr<hittable> left;
+	shared_ptr<hittable> right;
+	aabb bbox;
+
+	bvh_node(const std::vector<shared_ptr<hittable>>& objects, std::vector<bvh_primitive>& prims,
+		size_t start, size_t end) {
+		build(objects, prims, start, end);
+	}
+
+	void build(const std::vector<shared_ptr<hittable>>& objects, std::vector<bvh_primitive>& prims,
+		size_t start, size_t end) {
+		size_t span = end - start;
+
+		// an empty tree keeps an empty box, which no ray can hit
+		if (span == 0) return;
+
+		if (span == 1) {
+			left = right = objects[prims[start].index];
+		}
+		else if (span == 2) {
+			left = objects[prims[start].index];
+			right = objects[prims[start + 1].index];
+		}
+		else {
+			size_t mid = sah_partition(prims, start, end);
+			left = shared_ptr<bvh_node>(new bvh_node(objects, prims, start, mid));
+			right = shared_ptr<bvh_node>(new bvh_node(objects, prims, mid, end));
+		}
+
+		bbox = aabb(left->bounding_box(), right->bounding_box());
+	}
+};
+
+#endif // !BVH_H
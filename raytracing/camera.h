@@ -3,14 +3,22 @@
 
 #include "rtweekend.h"
 
+#include "accumulation.h"
+#include "aov.h"
 #include "color.h"
+#include "denoise.h"
+#include "framebuffer.h"
 #include "hittable.h"
 #include "material.h"
+#include "stats.h"
 
+#include "thread_pool.h"
+#include "wavefront.h"
 #include "time.h"
 
+#include<algorithm>
 #include<iostream>
-#include<fstream>
+#include<string>
 
 class camera {
 public:
@@ -18,6 +26,7 @@ public:
 	int image_width = 100;
 	int samples_per_pixel = 10;
 	int max_depth = 10;
+	int russian_roulette_depth = 5; // Bounces before Russian roulette may end a path, negative disables
 	
 	float vfov = 90; // Vertical view angle(field of view)
 	point3 lookfrom = point3(0, 0, -1); // Point camera is looking from
@@ -27,46 +36,221 @@ public:
 	float defocus_angle = 0; // Variation angle of rays through each pixel
 	float focus_dist = 0; // Distance from camera lookfrom point to plane of perfect focus
 
-	void render(const hittable &world) {
+	float shutter_open = 0; // Motion blur: rays sample times in [shutter_open, shutter_close], objects move over [0, 1]
+	float shutter_close = 0; // Motion blur: equal to shutter_open renders a single instant
+
+	int thread_count = 0; // Number of render threads, 0 uses every hardware thread
+	int tile_size = 16; // Width and height of the screen tiles handed to the threads
+	unsigned int seed = 0; // Base seed of the per-pixel random sequences
+	std::string output_file = "image.ppm"; // P6 PPM, or linear float PFM for a ".pfm" name
+
+	int samples_per_pass = 0; // Progressive mode: samples per pixel added by each pass, 0 renders in one pass
+	std::string checkpoint_file; // Progressive mode: accumulation snapshot saved after every pass and resumed at start
+
+	bool write_aovs = false; // Also write first-hit normal, albedo, depth and per-pixel variance next to output_file, as PFM
+	bool denoise = false; // Filter every written image with the edge-aware a-trous denoiser, guided by the AOVs
+	denoise_settings denoiser; // Strength and edge sensitivity of the denoiser
+
+	float adaptive_threshold = 0; // Adaptive sampling: pixels stop once their relative standard error is below this, 0 disables
+	int adaptive_min_samples = 16; // Adaptive sampling: samples every pixel takes before it may stop, also the pass size
+
+	sampler_type sampler = sampler_type::independent; // Sample generator: independent random numbers, scrambled Sobol, or blue noise dithered Sobol
+
+	bool packet_tracing = false; // Trace primary rays of neighbouring pixels together, single rays after the first hit
+	int packet_size = 8; // Rays per packet: 4 (2x2 pixels), 8 (4x2) or 16 (4x4)
+
+	const hittable* lights = nullptr; // Emitters sampled at every diffuse hit (next event estimation), e.g. a hittable_list of quads
+	bool sky = true; // Sky gradient background, false leaves the scene lit by its emitters only
+
+	bool wavefront = false; // Trace tiles breadth first, one bounce at a time, with the hits binned by material
+	int wavefront_paths = 1 << 14; // Paths in flight per thread in wavefront mode
+
+	void render(const hittable &world, const material_list& materials) {
 
 		std::clog << "=========Initialize...=========" << std::endl;
 
 		initialize();
 
 		timer time;
-		// Image
-		std::string filename = "image.ppm";
-		std::ofstream file(filename);
 
-		if (file.is_open()) {
+		std::clog << "=========Rendering...=========" << std::endl;
 
-			std::clog << "=========Rendering...=========" << std::endl;
+		// every tile adds to its own pixels of the shared accumulation buffer
+		accumulation_buffer accum(image_width, image_height);
+		framebuffer image(image_width, image_height);
+		bool features = write_aovs || denoise;
+		aov_buffer aov(features ? image_width : 0, features ? image_height : 0);
 
-			file << "P3\n" << image_width << " " << image_height << "\n255\n";
-			for (int j = 0; j < image_height; j++) {
-				for (int i = 0; i < image_width; i++) {
-					color pixel_color(0, 0, 0);
+		bool adaptive = adaptive_threshold > 0;
 
-					//multiple samples for one pixel
-					for (int sample = 0; sample < samples_per_pixel; sample++) {
-						ray r = get_ray(i, j);
-						pixel_color += ray_color(r, world, max_depth);
-					}
-					// average color 
-					pixel_color /= samples_per_pixel;
-					write_color(file, pixel_color);
-				}
+		// adaptive sampling decides which pixels still need samples between passes
+		int pass_samples = samples_per_pass > 0 ? samples_per_pass : (adaptive ? adaptive_min_samples : samples_per_pixel);
+		pass_samples = std::max(1, std::min(pass_samples, samples_per_pixel));
+		int pass_count = (samples_per_pixel + pass_samples - 1) / pass_samples;
+
+		checkpoint_header checkpoint;
+		checkpoint.seed = seed;
+		checkpoint.samples_per_pass = pass_samples;
+		checkpoint.sampler = static_cast<uint32_t>(sampler);
+
+		if (!checkpoint_file.empty() && accum.load(checkpoint_file, checkpoint, features ? &aov : nullptr))
+			std::clog << "Resuming from " << checkpoint_file << " after pass " << checkpoint.passes_done << std::endl;
+
+		int tiles_x = (image_width + tile_size - 1) / tile_size;
+		int tiles_y = (image_height + tile_size - 1) / tile_size;
+
+		thread_pool pool(thread_count);
+		std::vector<unsigned char> active(accum.count.size(), 1);
+		pass_time.clear();
+
+		reset_statistics(pool);
+
+		for (int pass = checkpoint.passes_done; pass < pass_count; pass++) {
+			int samples = std::min(pass_samples, samples_per_pixel - pass * pass_samples);
+
+			if (adaptive && !accum.update_active(active, adaptive_threshold, adaptive_min_samples))
+				break;
+
+			timer pass_timer;
+			for_tiles(pool, tiles_x * tiles_y, [&](int tile) {
+				render_tile(world, materials, tile % tiles_x, tile / tiles_x, pass, samples, active, accum,
+					features ? &aov : nullptr);
+			});
+			pass_time.push_back(pass_timer.duration());
+
+			// Image: in progressive mode every pass but the last leaves a preview behind
+			if (samples_per_pass > 0 && pass < pass_count - 1) {
+				resolve(accum, aov, image, pool);
+				image.write(output_file);
 			}
-			
 
+			if (!checkpoint_file.empty()) {
+				checkpoint.passes_done = pass + 1;
+				if (!accum.save(checkpoint_file, checkpoint, features ? &aov : nullptr))
+					std::cout << "Checkpoint write error" << std::endl;
+			}
+
+			if (pass_count > 1)
+				std::clog << "\rPass " << pass + 1 << "/" << pass_count << " done" << std::flush;
 		}
-		else {
-			std::cout << "File open error" << std::endl;
+
+		// the final image, also when every pixel converged early or a finished render was resumed
+		resolve(accum, aov, image, pool);
+		image.write(output_file);
+
+		if (write_aovs) {
+			std::vector<float> variance;
+			accum.resolve_variance(variance);
+			if (!aov.write(output_file, variance))
+				std::cout << "AOV write error" << std::endl;
 		}
 
+		if (adaptive)
+			std::clog << "\nAdaptive sampling: " << static_cast<float>(accum.total_samples()) / (image_width * image_height)
+				<< " samples per pixel on average" << std::endl;
+
 		float duration = time.duration();
-		file.close();
 		std::clog << "\nCompleted the output, ran for " << duration << " seconds" << std::endl;
+
+#if defined(RT_STATS)
+		if (!write_stats(stats_filename(output_file), worker_stats, duration))
+			std::cout << "Stats write error" << std::endl;
+#endif
+	}
+
+	// Render one still of samples_per_pixel into image on a caller owned pool, without
+	// passes, checkpoints or file output: the building block of animation.
+	void render_frame(const hittable& world, const material_list& materials, thread_pool& pool, framebuffer& image) {
+		initialize();
+
+		accumulation_buffer accum(image_width, image_height);
+		aov_buffer aov(denoise ? image_width : 0, denoise ? image_height : 0);
+		std::vector<unsigned char> active(accum.count.size(), 1);
+
+		int tiles_x = (image_width + tile_size - 1) / tile_size;
+		int tiles_y = (image_height + tile_size - 1) / tile_size;
+		reset_statistics(pool);
+		for_tiles(pool, tiles_x * tiles_y, [&](int tile) {
+			render_tile(world, materials, tile % tiles_x, tile / tiles_x, 0, samples_per_pixel, active, accum,
+				denoise ? &aov : nullptr);
+		});
+
+		if (image.width != image_width || image.height != image_height)
+			image = framebuffer(image_width, image_height);
+		resolve(accum, aov, image, pool);
+	}
+
+	// One unit of a distributed render: samples [first_sample, first_sample + samples) of the
+	// tile rows [row_begin, row_end), into accum and aov (image sized) on a caller owned pool.
+	// Seeds and sample indices depend on pass and first_sample only, so units rendered
+	// anywhere add up to the image render would give.
+	void render_band(const hittable& world, const material_list& materials, thread_pool& pool, int row_begin,
+		int row_end, int pass, int first_sample, int samples, accumulation_buffer& accum, aov_buffer* aov) {
+		initialize();
+
+		std::vector<unsigned char> active(accum.count.size(), 1);
+		int tiles_x = (image_width + tile_size - 1) / tile_size;
+
+		// the tiles read a pixel's sample count as where its sequence continues
+		size_t band_begin = static_cast<size_t>(std::min(row_begin * tile_size, image_height)) * image_width;
+		size_t band_end = static_cast<size_t>(std::min(row_end * tile_size, image_height)) * image_width;
+		for (size_t k = band_begin; k < band_end; k++)
+			accum.count[k] += first_sample;
+
+		// the counters of a job's units add up, a pool of another size starts them over
+#if defined(RT_STATS)
+		if (worker_stats.size() != static_cast<size_t>(pool.size()))
+			reset_statistics(pool);
+#endif
+		for_tiles(pool, tiles_x * (row_end - row_begin), [&](int tile) {
+			render_tile(world, materials, tile % tiles_x, row_begin + tile / tiles_x, pass, samples, active, accum, aov);
+		});
+
+		for (size_t k = band_begin; k < band_end; k++)
+			accum.count[k] -= first_sample;
+	}
+
+	// Resolve accum into output_file, denoised and with the AOVs if asked for: the end of a
+	// render whose samples were taken elsewhere
+	bool write_output(const accumulation_buffer& accum, const aov_buffer& aov, thread_pool& pool) const {
+		framebuffer image(accum.width, accum.height);
+		resolve(accum, aov, image, pool);
+		bool ok = image.write(output_file);
+		if (write_aovs) {
+			std::vector<float> variance;
+			accum.resolve_variance(variance);
+			if (!aov.write(output_file, variance)) {
+				std::cout << "AOV write error" << std::endl;
+				ok = false;
+			}
+		}
+		return ok;
+	}
+
+	// rows of the image, from image_width and aspect_ratio
+	int height() const {
+		int h = static_cast<int>(image_width / aspect_ratio);
+		return h < 1 ? 1 : h;
+	}
+
+	// seconds spent tracing each pass of the last render, image writes excluded
+	const std::vector<double>& pass_seconds() const { return pass_time; }
+
+#if defined(RT_STATS)
+	// merged counters of the last render or render_frame, or of the render_band calls since
+	const render_stats& statistics() const { return totals; }
+
+	// the same counters per worker thread of the pool
+	const std::vector<render_stats>& worker_statistics() const { return worker_stats; }
+#endif
+
+	// Counters start from zero, one slot per worker of pool. render and render_frame do this
+	// themselves, render_band adds to what is there.
+	void reset_statistics([[maybe_unused]] const thread_pool& pool) {
+#if defined(RT_STATS)
+		totals = render_stats();
+		worker_stats.assign(pool.size(), render_stats());
+#endif
 	}
 
 private:
@@ -78,10 +262,37 @@ private:
 	vec3 u, v, w;
 	vec3 defocus_disk_u;
 	vec3 defocus_disk_v;
+	std::vector<double> pass_time;
+#if defined(RT_STATS)
+	render_stats totals;
+	std::vector<render_stats> worker_stats;
+#endif
+
+	// Run tile(k) for every k below count on pool. With RT_STATS each worker's counters are
+	// moved into its slot after every tile, so none are left in the pool's threads for a
+	// later render to report, and the totals are merged at the end.
+	template <typename F>
+	void for_tiles(thread_pool& pool, int count, const F& tile) {
+		pool.parallel_for(count, [&](int k, [[maybe_unused]] int worker) {
+#if defined(RT_STATS)
+			timer tile_time;
+#endif
+			tile(k);
+#if defined(RT_STATS)
+			render_stats& local = thread_stats();
+			local.seconds += tile_time.duration();
+			worker_stats[worker].merge(local);
+			local = render_stats();
+#endif
+		});
+#if defined(RT_STATS)
+		totals = render_stats();
+		for (const auto& w : worker_stats) totals.merge(w);
+#endif
+	}
 
 	void initialize() {
-		image_height = static_cast<int>(image_width / aspect_ratio);
-		image_height = image_height < 1 ? 1 : image_height;
+		image_height = height();
 
 		center = lookfrom;
 
@@ -113,6 +324,288 @@ private:
 		defocus_disk_v = v * defocus_radius;
 	} 
 
+	// average the samples into image, denoised if asked for
+	void resolve(const accumulation_buffer& accum, const aov_buffer& aov, framebuffer& image, thread_pool& pool) const {
+		accum.resolve(image);
+		if (denoise) {
+			std::vector<float> variance;
+			accum.resolve_variance(variance);
+			denoise_image(image, aov, variance, pool, denoiser);
+		}
+	}
+
+	// aov, when given, collects the features of every sample
+	void render_tile(const hittable& world, const material_list& materials, int tile_x, int tile_y,
+		int pass, int samples, const std::vector<unsigned char>& active, accumulation_buffer& accum, aov_buffer* aov) const {
+		if (wavefront) {
+			render_tile_wavefront(world, materials, tile_x, tile_y, pass, samples, active, accum, aov);
+			return;
+		}
+		if (packet_tracing) {
+			render_tile_packets(world, materials, tile_x, tile_y, pass, samples, active, accum, aov);
+			return;
+		}
+
+		int i_end = std::min((tile_x + 1) * tile_size, image_width);
+		int j_end = std::min((tile_y + 1) * tile_size, image_height);
+
+		for (int j = tile_y * tile_size; j < j_end; j++) {
+			for (int i = tile_x * tile_size; i < i_end; i++) {
+				// converged in an earlier pass
+				if (!active[static_cast<size_t>(j) * image_width + i])
+					continue;
+
+				// seed per pixel, so the image does not depend on which thread renders the tile
+				// and per pass, so a resumed render continues the same sequences
+				seed_random(seed + pass * 0x9e3779b97f4a7c15ull, j * image_width + i);
+
+				color pixel_color(0, 0, 0);
+				float pixel_sq = 0;
+
+				// samples continue the pixel's sequence after those of earlier passes
+				int taken = accum.count[static_cast<size_t>(j) * image_width + i];
+
+				//multiple samples for one pixel
+				for (int sample = 0; sample < samples; sample++) {
+					start_sample(i, j, taken + sample);
+					ray r = get_ray(i, j);
+					aov_sample features;
+					color sample_color = ray_color(r, world, materials, max_depth, aov ? &features : nullptr);
+					if (aov)
+						aov->add(i, j, features);
+					pixel_color += sample_color;
+					pixel_sq += luminance(sample_color) * luminance(sample_color);
+				}
+				accum.add(i, j, pixel_color, pixel_sq, samples);
+			}
+		}
+	}
+
+	// Same samples as render_tile, but primary rays of a pixel block go through the scene as one
+	// packet. Each pixel keeps its own random stream, so the image matches the scalar path.
+	void render_tile_packets(const hittable& world, const material_list& materials, int tile_x, int tile_y,
+		int pass, int samples, const std::vector<unsigned char>& active, accumulation_buffer& accum, aov_buffer* aov) const {
+		int size = packet_size <= 4 ? 4 : (packet_size <= 8 ? 8 : 16);
+		int block_w = size == 4 ? 2 : 4;
+		int block_h = size / block_w;
+
+		int i_end = std::min((tile_x + 1) * tile_size, image_width);
+		int j_end = std::min((tile_y + 1) * tile_size, image_height);
+
+		for (int by = tile_y * tile_size; by < j_end; by += block_h) {
+			for (int bx = tile_x * tile_size; bx < i_end; bx += block_w) {
+				int px[ray_packet::max_size], py[ray_packet::max_size];
+				random_generator engines[ray_packet::max_size];
+				sample_sequence sequences[ray_packet::max_size];
+				int lanes = 0;
+
+				for (int j = by; j < std::min(by + block_h, j_end); j++) {
+					for (int i = bx; i < std::min(bx + block_w, i_end); i++) {
+						if (!active[static_cast<size_t>(j) * image_width + i])
+							continue;
+						seed_random(seed + pass * 0x9e3779b97f4a7c15ull, j * image_width + i);
+						engines[lanes] = random_engine();
+						px[lanes] = i;
+						py[lanes] = j;
+						lanes++;
+					}
+				}
+				if (lanes == 0) continue;
+
+				color pixel_color[ray_packet::max_size];
+				float pixel_sq[ray_packet::max_size] = {};
+				hit_record rec[ray_packet::max_size];
+				ray_packet packet;
+				packet.size = lanes;
+
+				for (int sample = 0; sample < samples; sample++) {
+					for (int l = 0; l < lanes; l++) {
+						random_engine() = engines[l];
+						start_sample(px[l], py[l], accum.count[static_cast<size_t>(py[l]) * image_width + px[l]] + sample);
+						packet.set(l, get_ray(px[l], py[l]));
+						engines[l] = random_engine();
+						sequences[l] = sample_stream();
+					}
+
+					RT_STATS_RAYS(0, lanes);
+					unsigned int hits = world.hit_packet(packet, (1u << lanes) - 1, rec);
+
+					for (int l = 0; l < lanes; l++) {
+						random_engine() = engines[l];
+						sample_stream() = sequences[l];
+						aov_sample features;
+						color sample_color = trace_path(packet.get(l), hits >> l & 1u, rec[l], world, materials, max_depth,
+							aov ? &features : nullptr);
+						engines[l] = random_engine();
+						if (aov)
+							aov->add(px[l], py[l], features);
+
+						pixel_color[l] += sample_color;
+						pixel_sq[l] += luminance(sample_color) * luminance(sample_color);
+					}
+				}
+
+				for (int l = 0; l < lanes; l++)
+					accum.add(px[l], py[l], pixel_color[l], pixel_sq[l], samples);
+			}
+		}
+	}
+
+	// Wavefront integrator: generate the primary rays of the whole tile, then per bounce
+	// 1. intersect every path in flight,
+	// 2. finish the misses and bin the hits by material type,
+	// 3. run each material's scatter kernel over its bin,
+	// 4. compact the surviving paths into the queue of the next bounce.
+	void render_tile_wavefront(const hittable& world, const material_list& materials, int tile_x, int tile_y,
+		int pass, int samples, const std::vector<unsigned char>& active, accumulation_buffer& accum, aov_buffer* aov) const {
+		int i_end = std::min((tile_x + 1) * tile_size, image_width);
+		int j_end = std::min((tile_y + 1) * tile_size, image_height);
+
+		std::vector<int> px, py;
+		for (int j = tile_y * tile_size; j < j_end; j++)
+			for (int i = tile_x * tile_size; i < i_end; i++)
+				if (active[static_cast<size_t>(j) * image_width + i]) {
+					px.push_back(i);
+					py.push_back(j);
+				}
+		if (px.empty()) return;
+
+		int pixel_count = static_cast<int>(px.size());
+		std::vector<color> pixel_color(pixel_count);
+		std::vector<float> pixel_sq(pixel_count, 0.f);
+
+		auto finish = [&](const wavefront_path& path, const color& c) {
+			pixel_color[path.pixel] += c;
+			pixel_sq[path.pixel] += luminance(c) * luminance(c);
+			if (aov)
+				aov->add(px[path.pixel], py[path.pixel], path.aov);
+		};
+
+		// bound the paths in flight by handing out the samples in chunks
+		int chunk = std::max(1, wavefront_paths / pixel_count);
+		wavefront_queue queue;
+
+		for (int first = 0; first < samples; first += chunk) {
+			int n = std::min(chunk, samples - first);
+
+			queue.clear();
+			for (int p = 0; p < pixel_count; p++) {
+				for (int s = 0; s < n; s++) {
+					// one stream per pixel sample
+					seed_random(seed + pass * 0x9e3779b97f4a7c15ull + (first + s) * 0xbf58476d1ce4e5b9ull,
+						py[p] * image_width + px[p]);
+					start_sample(px[p], py[p], accum.count[static_cast<size_t>(py[p]) * image_width + px[p]] + first + s);
+
+					wavefront_path path;
+					path.r = get_ray(px[p], py[p]);
+					path.throughput = color(1.f, 1.f, 1.f);
+					path.radiance = color(0, 0, 0);
+					path.bsdf_pdf = 0;
+					path.pixel = p;
+					path.aov = aov_sample();
+					path.rng = random_engine();
+					path.sequence = sample_stream();
+					queue.paths.push_back(path);
+				}
+			}
+
+			for (int bounce = 0; !queue.paths.empty(); bounce++) {
+				size_t count = queue.paths.size();
+
+				// intersect in bulk
+				queue.recs.resize(count);
+				queue.hits.resize(count);
+				RT_STATS_RAYS(bounce, count);
+				for (size_t k = 0; k < count; k++)
+					queue.hits[k] = world.hit(queue.paths[k].r, interval(0.001f, infinity), queue.recs[k]);
+
+				// misses see the sky, hits collect emission and are binned by material
+				for (auto& bin : queue.bins) bin.clear();
+				for (size_t k = 0; k < count; k++) {
+					wavefront_path& path = queue.paths[k];
+					if (!queue.hits[k]) {
+						finish(path, path.radiance + path.throughput * background(path.r));
+						continue;
+					}
+
+					const material& m = materials[queue.recs[k].mat];
+					if (aov)
+						record_aov(path.aov, bounce, path.r, queue.recs[k], m);
+					path.radiance += path.throughput * emitted_light(path.r, queue.recs[k], m, path.bsdf_pdf);
+					if (m.is_emissive())
+						finish(path, path.radiance);
+					else
+						queue.bins[static_cast<int>(m.type)].push_back(static_cast<int>(k));
+				}
+
+				// one kernel per material type, survivors are compacted in bin order
+				queue.next.clear();
+				scatter_bin(queue, queue.bins[static_cast<int>(material_type::lambertian)], world, materials, bounce, finish,
+					[](const material& m, const ray& r, const hit_record& rec, color& att, ray& out) {
+						return m.scatter_lambertian(r, rec, att, out);
+					});
+				scatter_bin(queue, queue.bins[static_cast<int>(material_type::metal)], world, materials, bounce, finish,
+					[](const material& m, const ray& r, const hit_record& rec, color& att, ray& out) {
+						return m.scatter_metal(r, rec, att, out);
+					});
+				scatter_bin(queue, queue.bins[static_cast<int>(material_type::dielectric)], world, materials, bounce, finish,
+					[](const material& m, const ray& r, const hit_record& rec, color& att, ray& out) {
+						return m.scatter_dielectric(r, rec, att, out);
+					});
+				queue.paths.swap(queue.next);
+			}
+		}
+
+		for (int p = 0; p < pixel_count; p++)
+			accum.add(px[p], py[p], pixel_color[p], pixel_sq[p], samples);
+	}
+
+	// scatter every path of a single-material bin, with the same termination rules as trace_path
+	template <typename Kernel, typename Finish>
+	void scatter_bin(wavefront_queue& queue, const std::vector<int>& bin, const hittable& world,
+		const material_list& materials, int bounce, const Finish& finish, Kernel kernel) const {
+		for (int k : bin) {
+			wavefront_path& path = queue.paths[k];
+			const hit_record& rec = queue.recs[k];
+			const material& m = materials[rec.mat];
+			random_engine() = path.rng;
+			sample_stream() = path.sequence;
+			sample_stream().start_bounce(bounce);
+
+			if (lights && m.is_diffuse())
+				path.radiance += path.throughput * direct_light(rec, m, path.r.time(), world, materials);
+
+			ray scattered;
+			color attenuation;
+			if (!kernel(m, path.r, rec, attenuation, scattered)) {
+				finish(path, path.radiance);
+				continue;
+			}
+
+			path.bsdf_pdf = m.is_diffuse() ? material::lambertian_pdf(rec, scattered.direction()) : 0.f;
+			path.throughput = path.throughput * attenuation;
+			path.r = scattered;
+
+			if (russian_roulette_depth >= 0 && bounce >= russian_roulette_depth) {
+				float survive = std::min(0.95f, std::max(path.throughput.x(), std::max(path.throughput.y(), path.throughput.z())));
+				if (random_float() >= survive) {
+					finish(path, path.radiance);
+					continue;
+				}
+				path.throughput /= survive;
+			}
+
+			if (bounce >= max_depth) {
+				finish(path, path.radiance);
+				continue;
+			}
+
+			path.rng = random_engine();
+			path.sequence = sample_stream();
+			queue.next.push_back(path);
+		}
+	}
+
 	ray get_ray(int i, int j) const {
 		auto pixel_center = pixel00_loc + (i * pixel_delta_u) + (j * pixel_delta_v);
 		
@@ -127,13 +620,23 @@ private:
 
 		auto ray_direction = pixel_sample - ray_origin;
 
-		return ray(ray_origin, ray_direction);
+		// motion blur: spread the samples over the time the shutter is open
+		auto ray_time = shutter_close > shutter_open ? shutter_open + (shutter_close - shutter_open) * random_float() : shutter_open;
+
+		return ray(ray_origin, ray_direction, ray_time);
+	}
+
+	// point the calling thread's sample sequence at sample number index of pixel (i, j)
+	void start_sample(int i, int j, int index) const {
+		sample_stream().start(sampler, seed, i, j, index);
 	}
 
 	vec3 pixel_sample_square() const {
 
-		auto px = -0.5 + random_float();
-		auto py = -0.5 + random_float();
+		float px, py;
+		random_float2(px, py);
+		px -= 0.5f;
+		py -= 0.5f;
 
 		return (px * pixel_delta_u) + (py * pixel_delta_v);
 	}
@@ -143,26 +646,119 @@ private:
 		return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
 	}
 
-	color ray_color(const ray& r, const hittable& world, int depth) const {
+	// sky gradient seen by rays that leave the scene
+	color background(const ray& r) const {
+		if (!sky)
+			return color(0, 0, 0);
+		vec3 unit_direction = unit_vector(r.direction());
+		auto a = 0.5f * (unit_direction.y() + 1.f);
+		return (1.f - a) * color(1.f, 1.f, 1.f) + a * color(0.5f, 0.7f, 1.f);
+	}
+
+	static float power_heuristic(float pdf, float other_pdf) {
+		return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+	}
+
+	// Emission seen at a hit. A diffuse bounce (bsdf_pdf > 0) could have found the same
+	// light by light sampling too, so its share is weighted by multiple importance sampling.
+	color emitted_light(const ray& r, const hit_record& rec, const material& m, float bsdf_pdf) const {
+		if (!m.is_emissive())
+			return color(0, 0, 0);
+		color emission = m.emitted(rec);
+		if (!lights || bsdf_pdf <= 0)
+			return emission;
+		float light_pdf = lights->pdf_value(r.origin(), r.direction(), r.time());
+		return emission * power_heuristic(bsdf_pdf, light_pdf);
+	}
+
+	// Next event estimation: one shadow ray towards a point picked on the lights,
+	// weighted against the chance of the lambertian scatter finding it.
+	color direct_light(const hit_record& rec, const material& m, float time, const hittable& world,
+		const material_list& materials) const {
+		vec3 direction = lights->random(rec.p, time);
+		float light_pdf = lights->pdf_value(rec.p, direction, time);
+		float bsdf_pdf = material::lambertian_pdf(rec, direction);
+		if (light_pdf <= 0 || bsdf_pdf <= 0)
+			return color(0, 0, 0);
+
+		hit_record light_rec;
+		RT_STATS_ADD(shadow_rays, 1);
+		if (!world.hit(ray(rec.p, direction, time), interval(0.001f, infinity), light_rec))
+			return color(0, 0, 0);
+		color emission = materials[light_rec.mat].emitted(light_rec);
+
+		// brdf * cosine / pdf, where brdf = albedo / pi and cosine / pi = bsdf_pdf
+		return m.albedo * emission * (bsdf_pdf * power_heuristic(light_pdf, bsdf_pdf) / light_pdf);
+	}
+
+	// record what the path sees at a hit into the sample's features, see aov_sample
+	static void record_aov(aov_sample& features, int bounce, const ray& r, const hit_record& rec, const material& m) {
+		if (features.done)
+			return;
+		if (bounce == 0)
+			features.depth = rec.t * r.direction().length();
+		if (m.is_diffuse() || m.is_emissive()) {
+			features.normal = rec.normal;
+			features.albedo = m.is_emissive() ? color(1.f, 1.f, 1.f) : m.albedo;
+			features.done = true;
+		}
+	}
+
+	color ray_color(const ray& r, const hittable& world, const material_list& materials, int depth,
+		aov_sample* features = nullptr) const {
 		hit_record rec;
+		RT_STATS_RAYS(0, 1);
+		bool hit = world.hit(r, interval(0.001f, infinity), rec);
+		return trace_path(r, hit, rec, world, materials, depth, features);
+	}
+
+	// continue a path whose first intersection (if any) is already in rec
+	color trace_path(const ray& r, bool hit, hit_record& rec, const hittable& world,
+		const material_list& materials, int depth, aov_sample* features = nullptr) const {
+		// iterative bounce loop: throughput carries the product of the attenuations so far,
+		// radiance the light collected from emitters along the way
+		ray current = r;
+		color throughput(1.f, 1.f, 1.f);
+		color radiance(0, 0, 0);
+		float bsdf_pdf = 0; // density of the last scatter direction, 0 after specular bounces
 
 		// limit the ray bounce
-		if (depth < 0) return color(0.f, 0.f, 0.f);
+		for (int bounce = 0; ; bounce++) {
+			if (!hit)
+				return radiance + throughput * background(current);
+
+			const material& m = materials[rec.mat];
+			if (features)
+				record_aov(*features, bounce, current, rec, m);
+			sample_stream().start_bounce(bounce);
+			radiance += throughput * emitted_light(current, rec, m, bsdf_pdf);
+
+			if (lights && m.is_diffuse())
+				radiance += throughput * direct_light(rec, m, current.time(), world, materials);
 
-		if (world.hit(r, interval(0.001f, infinity), rec)) {
 			ray scattered;
 			color attenuation;
-
-			// recursive
-			if (rec.m->scatter(r, rec, attenuation, scattered)) {
-				return attenuation * ray_color(scattered, world, depth - 1);
+			if (!m.scatter(current, rec, attenuation, scattered))
+				return radiance;
+
+			bsdf_pdf = m.is_diffuse() ? material::lambertian_pdf(rec, scattered.direction()) : 0.f;
+			throughput = throughput * attenuation;
+			current = scattered;
+
+			// Russian roulette: end dim paths early, and weight the survivors to stay unbiased
+			if (russian_roulette_depth >= 0 && bounce >= russian_roulette_depth) {
+				float survive = std::min(0.95f, std::max(throughput.x(), std::max(throughput.y(), throughput.z())));
+				if (random_float() >= survive)
+					return radiance;
+				throughput /= survive;
 			}
-			return color(0, 0, 0);
-		}
 
-		vec3 unit_direction = unit_vector(r.direction());
-		auto a = 0.5 * (unit_direction.y() + 1.0);
-		return (1.0 - a) * color(1.0, 1.0, 1.0) + a * color(0.5, 0.7, 1.0);
+			if (bounce >= depth)
+				return radiance;
+
+			RT_STATS_RAYS(bounce + 1, 1);
+			hit = world.hit(current, interval(0.001f, infinity), rec);
+		}
 	}
 };
 #endif // !CAMERA_H
@@ -0,0 +1,169 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "accumulation.h"
+#include "aov.h"
+#include "framebuffer.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+struct denoise_settings {
+	int iterations = 5; // a-trous passes; the footprint doubles with each, 5 passes span 125 pixels
+	float sigma_luminance = 4.f; // luminance differences, in standard deviations of the noise, that still blend
+	float sigma_normal = 32.f; // sharpness of the normal weight, like an exponent on the cosine between normals
+	float sigma_depth = 1.f; // depth differences, in multiples of what the local depth slope predicts, that still blend
+};
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) with the variance guided
+// luminance weight of SVGF (Schied et al. 2017). Each pass is a 5x5 B3 spline filter
+// whose taps lie 2^pass pixels apart; a tap's weight falls off with the difference in
+// normal, depth (against the change the depth slope predicts, so planes seen at grazing
+// angles still blend) and, relative to the estimated noise, luminance. The filter works on
+// radiance divided by albedo, so texture and material edges survive, and the variance
+// is filtered along so later passes know how much noise is left. Rows are spread over
+// the pool.
+inline void denoise_image(framebuffer& image, const aov_buffer& aov, const std::vector<float>& variance,
+	thread_pool& pool, const denoise_settings& settings = denoise_settings()) {
+	const int width = image.width, height = image.height;
+	const size_t pixel_count = image.pixels.size();
+	const int rows_per_task = 8;
+	const int tasks = (height + rows_per_task - 1) / rows_per_task;
+
+	auto for_rows = [&](const std::function<void(int)>& row) {
+		pool.parallel_for(tasks, [&](int task, int) {
+			int end = std::min(height, (task + 1) * rows_per_task);
+			for (int j = task * rows_per_task; j < end; j++) row(j);
+		});
+	};
+
+	// what a tap reads is packed per pixel, the wide passes touch a new cache line per tap
+	struct guide {
+		vec3 normal; // zero for background
+		float depth;
+	};
+	struct texel {
+		color value;
+		float variance;
+		float luminance;
+	};
+
+	// guides, and the demodulated image: dark albedo would divide noise up, those pixels stay as they are
+	std::vector<guide> guides(pixel_count);
+	std::vector<color> albedo(pixel_count);
+	std::vector<texel> current(pixel_count);
+	for (size_t k = 0; k < pixel_count; k++) {
+		guides[k].normal = aov.mean_normal(k);
+		guides[k].depth = aov.mean_depth(k);
+		color a = aov.mean_albedo(k);
+		for (int c = 0; c < 3; c++)
+			a[c] = a[c] > 0.01f ? a[c] : 1.f;
+		albedo[k] = a;
+		const color& c = image.pixels[k];
+		current[k].value = color(c.x() / a.x(), c.y() / a.y(), c.z() / a.z());
+		float l = luminance(a);
+		current[k].variance = variance[k] / (l * l);
+	}
+
+	// screen space depth slope, from the flatter side so silhouettes do not steepen it
+	std::vector<float> slope_x(pixel_count), slope_y(pixel_count);
+	for (int j = 0; j < height; j++)
+		for (int i = 0; i < width; i++) {
+			size_t k = static_cast<size_t>(j) * width + i;
+			float d = guides[k].depth;
+			float left = i > 0 ? std::fabs(d - guides[k - 1].depth) : infinity;
+			float right = i < width - 1 ? std::fabs(guides[k + 1].depth - d) : infinity;
+			float up = j > 0 ? std::fabs(d - guides[k - width].depth) : infinity;
+			float down = j < height - 1 ? std::fabs(guides[k + width].depth - d) : infinity;
+			slope_x[k] = width > 1 ? std::min(left, right) : 0.f;
+			slope_y[k] = height > 1 ? std::min(up, down) : 0.f;
+		}
+
+	std::vector<texel> next(pixel_count);
+	std::vector<float> blurred_variance(pixel_count);
+	static const float spline[5] = { 1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16 };
+
+	for (int pass = 0; pass < settings.iterations; pass++) {
+		int step = 1 << pass;
+
+		// a 3x3 Gaussian over the variance steadies the luminance weight
+		for_rows([&](int j) {
+			for (int i = 0; i < width; i++) {
+				size_t p = static_cast<size_t>(j) * width + i;
+				current[p].luminance = luminance(current[p].value);
+				float sum = 0, weight = 0;
+				for (int y = std::max(0, j - 1); y <= std::min(height - 1, j + 1); y++)
+					for (int x = std::max(0, i - 1); x <= std::min(width - 1, i + 1); x++) {
+						float w = (y == j ? 2.f : 1.f) * (x == i ? 2.f : 1.f);
+						sum += w * current[static_cast<size_t>(y) * width + x].variance;
+						weight += w;
+					}
+				blurred_variance[p] = sum / weight;
+			}
+		});
+
+		for_rows([&](int j) {
+			for (int i = 0; i < width; i++) {
+				size_t p = static_cast<size_t>(j) * width + i;
+				const guide& gp = guides[p];
+				float lp = current[p].luminance;
+				float luminance_scale = 1.f / (settings.sigma_luminance * std::sqrt(blurred_variance[p]) + 1e-4f);
+				float depth_x = settings.sigma_depth * step * slope_x[p];
+				float depth_y = settings.sigma_depth * step * slope_y[p];
+				float depth_floor = 1e-3f * gp.depth + 1e-6f;
+				bool sky_p = gp.normal.length_squared() == 0;
+
+				color sum(0, 0, 0);
+				float sum_variance = 0, sum_weight = 0;
+				for (int dy = -2; dy <= 2; dy++) {
+					int y = j + dy * step;
+					if (y < 0 || y >= height) continue;
+					for (int dx = -2; dx <= 2; dx++) {
+						int x = i + dx * step;
+						if (x < 0 || x >= width) continue;
+						size_t q = static_cast<size_t>(y) * width + x;
+						const texel& tq = current[q];
+
+						float w = spline[dx + 2] * spline[dy + 2];
+						if (q != p) {
+							// background only blends with background, surfaces with surfaces facing alike
+							const guide& gq = guides[q];
+							bool sky_q = gq.normal.length_squared() == 0;
+							if (sky_p != sky_q) continue;
+							float normal_term = 0;
+							if (!sky_p) {
+								// exp(sigma (cos - 1)) matches cos^sigma at the small angles that blend, without a log
+								float cosine = dot(gp.normal, gq.normal);
+								if (cosine <= 0) continue;
+								normal_term = settings.sigma_normal * (cosine - 1.f);
+							}
+
+							float expected = depth_x * std::abs(dx) + depth_y * std::abs(dy) + depth_floor;
+							float depth_term = std::fabs(gp.depth - gq.depth) / expected;
+							float luminance_term = std::fabs(lp - tq.luminance) * luminance_scale;
+							// the three weights multiply, so their exponents add up
+							w *= std::exp(normal_term - depth_term - luminance_term);
+						}
+
+						sum += w * tq.value;
+						sum_variance += w * w * tq.variance;
+						sum_weight += w;
+					}
+				}
+
+				next[p].value = sum / sum_weight;
+				next[p].variance = sum_variance / (sum_weight * sum_weight);
+			}
+		});
+
+		current.swap(next);
+	}
+
+	for (size_t k = 0; k < pixel_count; k++)
+		image.pixels[k] = current[k].value * albedo[k];
+}
+
+#endif // !DENOISE_H
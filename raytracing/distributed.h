@@ -0,0 +1,353 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "accumulation.h"
+#include "aov.h"
+#include "camera.h"
+#include "net.h"
+#include "scene.h"
+#include "thread_pool.h"
+#include "time.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Distributed rendering. A coordinator cuts the image into bands of tile rows, and in
+// progressive mode every band into its passes, and hands these units to worker processes
+// on this machine or others, one TCP connection each. Per connection:
+//
+//   coordinator -> worker   render_job, then the binary scene
+//   worker -> coordinator   uint32 1 once the scene is built, 0 if it is not
+//   coordinator -> worker   render_unit
+//   worker -> coordinator   the unit's rows of the accumulation (and AOV) sums
+//   ...                     more units, until one without samples ends the job
+//
+// Seeds depend on pixel, pass and sample only, so the merged image is the one a local
+// render gives. A worker that drops the connection or times out is let go and its unit
+// goes back to the queue; units still queued once no worker is left are rendered here.
+// Both ends must share a byte order.
+
+// Everything a worker needs besides the scene
+struct render_job {
+	char magic[4] = { 'R', 'T', 'J', 'B' };
+	uint32_t version = 2;
+	scene_camera view; // replaces the camera of the scene
+	uint32_t seed = 0;
+	int32_t sampler = 0; // sampler_type
+	int32_t russian_roulette_depth = 5;
+	float shutter_open = 0;
+	float shutter_close = 0;
+	int32_t tile_size = 16;
+	int32_t packet_tracing = 0;
+	int32_t packet_size = 8;
+	int32_t wavefront = 0;
+	int32_t wavefront_paths = 0;
+	int32_t features = 0; // also send the AOV sums back
+	int32_t bvh = 0; // bvh_layout of the scene's top level
+	uint32_t scene_size = 0; // bytes of binary scene that follow
+};
+
+// Samples [first_sample, first_sample + samples) of the tile rows [row_begin, row_end)
+struct render_unit {
+	int32_t row_begin = 0;
+	int32_t row_end = 0;
+	int32_t pass = 0;
+	int32_t first_sample = 0;
+	int32_t samples = 0; // 0 ends the job
+};
+
+// Floats of the reply to a unit covering pixels [begin, end): sums, squared sums and
+// counts, then the AOV normal, albedo, depth and count sums. Counts travel as floats,
+// exact up to 2^24 samples per pixel.
+inline size_t band_message_size(size_t begin, size_t end, bool features) {
+	return (end - begin) * (features ? 13 : 5);
+}
+
+// Move the pixels [begin, end) of accum and aov into message, leaving them zero for the next unit
+inline void take_band(accumulation_buffer& accum, aov_buffer* aov, size_t begin, size_t end, std::vector<float>& message) {
+	message.resize(band_message_size(begin, end, aov != nullptr));
+	float* p = message.data();
+	for (size_t k = begin; k < end; k++) {
+		for (int c = 0; c < 3; c++) *p++ = accum.sum[k][c];
+		*p++ = accum.sum_sq[k];
+		*p++ = static_cast<float>(accum.count[k]);
+		accum.sum[k] = color(0, 0, 0);
+		accum.sum_sq[k] = 0;
+		accum.count[k] = 0;
+		if (aov) {
+			for (int c = 0; c < 3; c++) *p++ = aov->normal[k][c];
+			for (int c = 0; c < 3; c++) *p++ = aov->albedo[k][c];
+			*p++ = aov->depth[k];
+			*p++ = static_cast<float>(aov->count[k]);
+			aov->normal[k] = vec3(0, 0, 0);
+			aov->albedo[k] = color(0, 0, 0);
+			aov->depth[k] = 0;
+			aov->count[k] = 0;
+		}
+	}
+}
+
+// Add a message of take_band to the pixels [begin, end) of accum and aov
+inline void add_band(accumulation_buffer& accum, aov_buffer* aov, size_t begin, size_t end, const std::vector<float>& message) {
+	const float* p = message.data();
+	for (size_t k = begin; k < end; k++) {
+		accum.sum[k] += color(p[0], p[1], p[2]);
+		accum.sum_sq[k] += p[3];
+		accum.count[k] += static_cast<int>(p[4]);
+		p += 5;
+		if (aov) {
+			aov->normal[k] += vec3(p[0], p[1], p[2]);
+			aov->albedo[k] += color(p[3], p[4], p[5]);
+			aov->depth[k] += p[6];
+			aov->count[k] += static_cast<int>(p[7]);
+			p += 8;
+		}
+	}
+}
+
+// Worker side of one job, until the coordinator ends it (true) or the connection fails
+inline bool serve_render_job(tcp_connection& peer, thread_pool& pool) {
+	render_job job, expected;
+	if (!peer.receive_value(job)) return false;
+	if (std::memcmp(job.magic, expected.magic, 4) != 0 || job.version != expected.version
+		|| job.bvh < 0 || job.bvh > static_cast<int32_t>(bvh_layout::wide8)) {
+		std::cerr << "Not a render job of this version" << std::endl;
+		return false;
+	}
+	std::vector<unsigned char> scene(job.scene_size);
+	if (!peer.receive_all(scene.data(), scene.size())) return false;
+
+	hittable_list world;
+	hittable_list lights;
+	material_list materials;
+	camera cam;
+	bool built = build_scene_binary(scene.data(), scene.size(), "Received scene", world, lights, materials, cam,
+		static_cast<bvh_layout>(job.bvh));
+	if (!peer.send_value(static_cast<uint32_t>(built ? 1 : 0)) || !built)
+		return false;
+
+	job.view.apply(cam);
+	if (!lights.objects.empty())
+		cam.lights = &lights;
+	cam.seed = job.seed;
+	cam.sampler = static_cast<sampler_type>(job.sampler);
+	cam.russian_roulette_depth = job.russian_roulette_depth;
+	cam.shutter_open = job.shutter_open;
+	cam.shutter_close = job.shutter_close;
+	cam.tile_size = job.tile_size;
+	cam.packet_tracing = job.packet_tracing != 0;
+	cam.packet_size = job.packet_size;
+	cam.wavefront = job.wavefront != 0;
+	cam.wavefront_paths = job.wavefront_paths;
+
+	int width = cam.image_width, height = cam.height();
+	int tile_rows = (height + cam.tile_size - 1) / cam.tile_size;
+	accumulation_buffer accum(width, height);
+	aov_buffer aov(job.features ? width : 0, job.features ? height : 0);
+	std::clog << "Rendering a " << width << "x" << height << " job" << std::endl;
+	cam.reset_statistics(pool);
+
+	std::vector<float> message;
+	for (;;) {
+		render_unit unit;
+		if (!peer.receive_value(unit)) return false;
+		if (unit.samples <= 0) {
+#if defined(RT_STATS)
+			// a worker writes no image, so the job's counters go to the log
+			const render_stats& stats = cam.statistics();
+			std::clog << "Traced " << stats.total_rays() << " rays in " << stats.seconds << " thread seconds" << std::endl;
+#endif
+			return true;
+		}
+		if (unit.row_begin < 0 || unit.row_end > tile_rows || unit.row_begin >= unit.row_end) {
+			std::cerr << "Render unit out of the image" << std::endl;
+			return false;
+		}
+
+		cam.render_band(world, materials, pool, unit.row_begin, unit.row_end, unit.pass, unit.first_sample,
+			unit.samples, accum, job.features ? &aov : nullptr);
+
+		size_t begin = static_cast<size_t>(unit.row_begin) * cam.tile_size * width;
+		size_t end = static_cast<size_t>(std::min(unit.row_end * cam.tile_size, height)) * width;
+		take_band(accum, job.features ? &aov : nullptr, begin, end, message);
+		if (!peer.send_all(message.data(), message.size() * sizeof(float))) return false;
+	}
+}
+
+// Take render jobs on port, one coordinator after the other, until the process is killed
+inline bool serve_render_jobs(int port, int thread_count = 0) {
+	tcp_listener listener;
+	if (!listener.listen(port)) {
+		std::cout << "Can not listen on port " << port << std::endl;
+		return false;
+	}
+	thread_pool pool(thread_count);
+	std::clog << "Worker on port " << port << " with " << pool.size() << " threads" << std::endl;
+
+	for (;;) {
+		tcp_connection peer = listener.accept();
+		if (!peer.is_open()) continue;
+		if (serve_render_job(peer, pool))
+			std::clog << "Job done" << std::endl;
+		else
+			std::clog << "Job ended by a failure" << std::endl;
+	}
+}
+
+// Render cam's image with the workers at addresses ("host:port") and write it like render
+// does. scene is the binary form of world and materials, which stay here for units no
+// worker is left for. A worker that does not answer within timeout_seconds counts as
+// failed, 0 waits forever. The workers build the scene with layout, as world was.
+// No stats file is written: with RT_STATS each worker logs the counters of its job and
+// cam.statistics() holds those of the units rendered here.
+// Returns false if the image could not be written.
+inline bool render_distributed(camera& cam, const hittable& world, const material_list& materials,
+	const std::vector<unsigned char>& scene, const std::vector<std::string>& addresses, int timeout_seconds = 0,
+	bvh_layout layout = bvh_layout::binary) {
+	timer time;
+
+	int width = cam.image_width, height = cam.height();
+	bool features = cam.write_aovs || cam.denoise;
+	accumulation_buffer accum(width, height);
+	aov_buffer aov(features ? width : 0, features ? height : 0);
+
+	render_job job;
+	job.view.capture(cam);
+	job.seed = cam.seed;
+	job.sampler = static_cast<int32_t>(cam.sampler);
+	job.russian_roulette_depth = cam.russian_roulette_depth;
+	job.shutter_open = cam.shutter_open;
+	job.shutter_close = cam.shutter_close;
+	job.tile_size = cam.tile_size;
+	job.packet_tracing = cam.packet_tracing ? 1 : 0;
+	job.packet_size = cam.packet_size;
+	job.wavefront = cam.wavefront ? 1 : 0;
+	job.wavefront_paths = cam.wavefront_paths;
+	job.features = features ? 1 : 0;
+	job.bvh = static_cast<int32_t>(layout);
+	job.scene_size = static_cast<uint32_t>(scene.size());
+
+	// a few bands per worker balance the load and keep what a failure costs small
+	int tile_rows = (height + cam.tile_size - 1) / cam.tile_size;
+	int worker_count = std::max(1, static_cast<int>(addresses.size()));
+	int band_rows = std::max(1, tile_rows / (4 * worker_count));
+
+	int pass_samples = cam.samples_per_pass > 0 ? std::min(cam.samples_per_pass, cam.samples_per_pixel) : cam.samples_per_pixel;
+	pass_samples = std::max(1, pass_samples);
+	int pass_count = (cam.samples_per_pixel + pass_samples - 1) / pass_samples;
+
+	std::deque<render_unit> pending;
+	for (int pass = 0; pass < pass_count; pass++)
+		for (int row = 0; row < tile_rows; row += band_rows) {
+			render_unit unit;
+			unit.row_begin = row;
+			unit.row_end = std::min(row + band_rows, tile_rows);
+			unit.pass = pass;
+			unit.first_sample = pass * pass_samples;
+			unit.samples = std::min(pass_samples, cam.samples_per_pixel - unit.first_sample);
+			pending.push_back(unit);
+		}
+	size_t unit_count = pending.size();
+
+	auto band_begin = [&](const render_unit& unit) { return static_cast<size_t>(unit.row_begin) * cam.tile_size * width; };
+	auto band_end = [&](const render_unit& unit) {
+		return static_cast<size_t>(std::min(unit.row_end * cam.tile_size, height)) * width;
+	};
+
+	std::mutex lock;
+	std::condition_variable changed;
+	int in_flight = 0;
+	size_t done = 0;
+
+	std::clog << "=========Rendering on " << addresses.size() << " workers...=========" << std::endl;
+
+	auto run_worker = [&](const std::string& address) {
+		tcp_connection peer;
+		uint32_t built = 0;
+		if (!peer.connect(address)) {
+			std::lock_guard<std::mutex> guard(lock);
+			std::cout << "Can not reach worker " << address << std::endl;
+			return;
+		}
+		peer.set_timeout(timeout_seconds);
+		if (!peer.send_value(job) || !peer.send_all(scene.data(), scene.size()) || !peer.receive_value(built) || !built) {
+			std::lock_guard<std::mutex> guard(lock);
+			std::cout << "Worker " << address << " did not take the scene" << std::endl;
+			return;
+		}
+
+		std::vector<float> message;
+		size_t units = 0;
+		for (;;) {
+			render_unit unit;
+			{
+				// an empty queue is final only once no unit in flight can fail and come back
+				std::unique_lock<std::mutex> guard(lock);
+				changed.wait(guard, [&] { return !pending.empty() || in_flight == 0; });
+				if (pending.empty()) break;
+				unit = pending.front();
+				pending.pop_front();
+				in_flight++;
+			}
+
+			message.resize(band_message_size(band_begin(unit), band_end(unit), features));
+			bool ok = peer.send_value(unit) && peer.receive_all(message.data(), message.size() * sizeof(float));
+
+			std::lock_guard<std::mutex> guard(lock);
+			in_flight--;
+			if (!ok) {
+				pending.push_front(unit);
+				changed.notify_all();
+				std::cout << "\nWorker " << address << " failed, its unit goes back to the queue" << std::endl;
+				return;
+			}
+			add_band(accum, features ? &aov : nullptr, band_begin(unit), band_end(unit), message);
+			done++;
+			units++;
+			changed.notify_all();
+			std::clog << "\rUnits " << done << "/" << unit_count << " done" << std::flush;
+		}
+
+		render_unit end_of_job;
+		peer.send_value(end_of_job);
+		std::lock_guard<std::mutex> guard(lock);
+		std::clog << "\nWorker " << address << " rendered " << units << " units" << std::flush;
+	};
+
+	std::vector<std::thread> threads;
+	for (const auto& address : addresses)
+		threads.emplace_back(run_worker, address);
+	for (auto& thread : threads)
+		thread.join();
+
+	thread_pool pool(cam.thread_count);
+	cam.reset_statistics(pool);
+	if (!pending.empty()) {
+		std::cout << "\nNo worker left, rendering the last " << pending.size() << " units here" << std::endl;
+		accumulation_buffer scratch(width, height);
+		aov_buffer scratch_aov(features ? width : 0, features ? height : 0);
+		std::vector<float> message;
+		for (const render_unit& unit : pending) {
+			cam.render_band(world, materials, pool, unit.row_begin, unit.row_end, unit.pass, unit.first_sample,
+				unit.samples, scratch, features ? &scratch_aov : nullptr);
+			take_band(scratch, features ? &scratch_aov : nullptr, band_begin(unit), band_end(unit), message);
+			add_band(accum, features ? &aov : nullptr, band_begin(unit), band_end(unit), message);
+		}
+	}
+
+	bool ok = cam.write_output(accum, aov, pool);
+	if (!ok)
+		std::cout << "Output write error" << std::endl;
+	std::clog << "\nCompleted the output, ran for " << time.duration() << " seconds" << std::endl;
+	return ok;
+}
+
+#endif // !DISTRIBUTED_H
@@ -0,0 +1,84 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "color.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Linear float image kept in memory while rendering, written once at the end
+class framebuffer {
+public:
+	int width = 0;
+	int height = 0;
+	std::vector<color> pixels; // row major, top row first
+
+	framebuffer() {}
+	framebuffer(int w, int h) : width(w), height(h), pixels(static_cast<size_t>(w) * h) {}
+
+	color& at(int i, int j) { return pixels[static_cast<size_t>(j) * width + i]; }
+	const color& at(int i, int j) const { return pixels[static_cast<size_t>(j) * width + i]; }
+
+	// pick the format from the extension: ".pfm" keeps linear floats, anything else is P6 PPM
+	bool write(const std::string& filename) const {
+		auto dot = filename.find_last_of('.');
+		if (dot != std::string::npos && filename.substr(dot) == ".pfm")
+			return write_pfm(filename);
+		return write_ppm(filename);
+	}
+
+	// binary P6 PPM, gamma corrected 8 bit
+	bool write_ppm(const std::string& filename) const {
+		std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+
+		std::vector<unsigned char> data(header.size() + pixels.size() * 3);
+		std::memcpy(data.data(), header.data(), header.size());
+
+		unsigned char* rgb = data.data() + header.size();
+		for (size_t k = 0; k < pixels.size(); k++)
+			color_to_bytes(pixels[k], rgb + 3 * k);
+
+		return write_file(filename, data.data(), data.size());
+	}
+
+	// PFM, linear 32 bit float RGB for HDR output. Rows are stored bottom to top
+	// and a negative scale marks little endian data.
+	bool write_pfm(const std::string& filename) const {
+		std::string header = "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+
+		size_t row_bytes = static_cast<size_t>(width) * 3 * sizeof(float);
+		std::vector<unsigned char> data(header.size() + row_bytes * height);
+		std::memcpy(data.data(), header.data(), header.size());
+
+		// rows are packed in a float row and copied, the header leaves them unaligned
+		unsigned char* rows = data.data() + header.size();
+		std::vector<float> row(static_cast<size_t>(width) * 3);
+		for (int j = 0; j < height; j++) {
+			const color* src = &at(0, height - 1 - j);
+			for (int i = 0; i < width; i++) {
+				row[3 * i + 0] = src[i].x();
+				row[3 * i + 1] = src[i].y();
+				row[3 * i + 2] = src[i].z();
+			}
+			std::memcpy(rows + row_bytes * j, row.data(), row_bytes);
+		}
+
+		return write_file(filename, data.data(), data.size());
+	}
+
+private:
+	static bool write_file(const std::string& filename, const unsigned char* data, size_t size) {
+		std::ofstream file(filename, std::ios::binary);
+		if (!file.is_open()) {
+			std::cout << "File open error" << std::endl;
+			return false;
+		}
+		file.write(reinterpret_cast<const char*>(data), size);
+		return file.good();
+	}
+};
+
+#endif // !FRAMEBUFFER_H
@@ -3,13 +3,17 @@
 
 #include "rtweekend.h"
 
-class material;
+#include "aabb.h"
+#include "ray_packet.h"
+#include "stats.h"
+
+#include <cstdint>
 
 class hit_record {
 public:
 	point3 p;
 	vec3 normal;
-	shared_ptr<material> m;
+	uint32_t mat; // index into the scene's material_list
 	float t;
 	bool front_face;
 
@@ -26,6 +30,33 @@ class hittable {
 public:
 	virtual ~hittable() = default;
 	virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
+
+	virtual aabb bounding_box() const = 0;
+
+	// Light sampling, for shapes used as lights: the density over solid angle with which
+	// random(origin, time) picks direction, and a direction from origin towards the shape
+	// as it is at time.
+	virtual float pdf_value(const point3& /*origin*/, const vec3& /*direction*/, float /*time*/) const { return 0.f; }
+	virtual vec3 random(const point3& /*origin*/, float /*time*/) const { return vec3(1, 0, 0); }
+
+	// Recompute cached bounds after something below moved, keeping the tree shape.
+	// Geometry that never moves keeps its bounds.
+	virtual void refit() {}
+
+	// Intersect the lanes of a packet selected by mask. A lane that finds a hit closer
+	// than its tmax fills rec[lane], shrinks its tmax and is set in the returned mask.
+	// By default every lane is traced on its own.
+	virtual unsigned int hit_packet(ray_packet& packet, unsigned int mask, hit_record* rec) const {
+		unsigned int hits = 0;
+		for (int l = 0; l < packet.size; l++) {
+			if (!(mask >> l & 1u)) continue;
+			if (hit(packet.get(l), interval(packet.tmin, packet.tmax[l]), rec[l])) {
+				packet.tmax[l] = rec[l].t;
+				hits |= 1u << l;
+			}
+		}
+		return hits;
+	}
 };
 
 #endif // !HITTABLE_H
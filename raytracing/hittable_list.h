@@ -17,10 +17,14 @@ public:
 	hittable_list() {}
 	hittable_list(shared_ptr<hittable> object) { add(object); }
 
-	void clear() { objects.clear(); }
+	void clear() {
+		objects.clear();
+		bbox = aabb();
+	}
 	
 	void add(shared_ptr<hittable> object) {
 		objects.push_back(object);
+		bbox = aabb(bbox, object->bounding_box());
 	}
 
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
@@ -39,5 +43,41 @@ public:
 
 		return hit_anything;
 	}
+
+	unsigned int hit_packet(ray_packet& packet, unsigned int mask, hit_record* rec) const override {
+		// every lane's tmax shrinks as it hits, so each object only has to beat the closest so far
+		unsigned int hits = 0;
+		for (const auto& object : objects)
+			hits |= object->hit_packet(packet, mask, rec);
+		return hits;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	// as a set of lights: pick one uniformly, so the density is the average of all of them
+	float pdf_value(const point3& origin, const vec3& direction, float time) const override {
+		if (objects.empty()) return 0.f;
+		float sum = 0.f;
+		for (const auto& object : objects)
+			sum += object->pdf_value(origin, direction, time);
+		return sum / objects.size();
+	}
+
+	vec3 random(const point3& origin, float time) const override {
+		int size = static_cast<int>(objects.size());
+		int k = static_cast<int>(random_float() * size);
+		return objects[k < size ? k : size - 1]->random(origin, time);
+	}
+
+	void refit() override {
+		bbox = aabb();
+		for (const auto& object : objects) {
+			object->refit();
+			bbox = aabb(bbox, object->bounding_box());
+		}
+	}
+
+private:
+	aabb bbox;
 };
 #endif // !HITTABLE_LIST_H
@@ -0,0 +1,91 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "transform.h"
+
+#include <cstdint>
+
+// A placement of shared geometry: the object (a sphere, a mesh, or a whole bvh_node as
+// bottom level hierarchy) is stored once, every instance only adds a 3x4 transform.
+// A bvh_node over instances forms the top level of a two-level hierarchy.
+class instance : public hittable {
+public:
+	static constexpr uint32_t keep_material = 0xffffffffu;
+
+	instance(shared_ptr<hittable> _object, const transform& _to_world, uint32_t _material = keep_material)
+		: object(_object), mat(_material) {
+		set_transform(_to_world);
+	}
+
+	// move the instance; the bvh_node above it needs a refit() afterwards
+	void set_transform(const transform& _to_world) {
+		to_world = _to_world;
+		to_object = _to_world.inverse();
+		refit();
+	}
+
+	const transform& get_transform() const { return to_world; }
+
+	// Motion blur: the instance slides by offset from time 0 to time 1 on top of its
+	// transform. The bounds grow to cover the whole slide.
+	void set_motion(const vec3& offset) {
+		motion = offset;
+		is_moving = offset.x() != 0 || offset.y() != 0 || offset.z() != 0;
+		refit();
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		point3 origin = is_moving ? r.origin() - r.time() * motion : r.origin();
+
+		// the direction is not renormalized, so t means the same in both spaces
+		ray local(to_object.apply_point(origin), to_object.apply_vector(r.direction()), r.time());
+
+		if (!object->hit(local, ray_t, rec))
+			return false;
+
+		rec.p = to_world.apply_point(rec.p);
+		if (is_moving)
+			rec.p += r.time() * motion;
+		// normals transform with the inverse transpose; the facing against the ray is preserved
+		rec.normal = unit_vector(to_object.apply_transposed(rec.normal));
+		if (mat != keep_material)
+			rec.mat = mat;
+
+		return true;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	// world bounds from the eight transformed corners of the object bounds. Shared
+	// geometry is not refit from here, so it is done once and not once per instance.
+	void refit() override {
+		aabb local = object->bounding_box();
+		bbox = aabb();
+		for (int k = 0; k < 8; k++) {
+			point3 corner(
+				k & 1 ? local.x.max : local.x.min,
+				k & 2 ? local.y.max : local.y.min,
+				k & 4 ? local.z.max : local.z.min);
+			point3 p = to_world.apply_point(corner);
+			bbox = aabb(bbox, aabb(p, p));
+		}
+		if (is_moving) {
+			point3 lo(bbox.x.min, bbox.y.min, bbox.z.min), hi(bbox.x.max, bbox.y.max, bbox.z.max);
+			bbox = aabb(bbox, aabb(lo + motion, hi + motion));
+		}
+	}
+
+private:
+	shared_ptr<hittable> object;
+	transform to_world;
+	transform to_object;
+	uint32_t mat; // overrides the object's materials unless keep_material
+	bool is_moving = false;
+	vec3 motion; // world space slide from time 0 to time 1
+	aabb bbox;
+};
+
+#endif // !INSTANCE_H
@@ -7,6 +7,13 @@ public:
 	
 	interval() : min(+infinity), max(-infinity){}
 	interval(float _min, float _max) : min(_min), max(_max) {}
+	// the tightest interval enclosing both a and b
+	interval(const interval& a, const interval& b)
+		: min(a.min <= b.min ? a.min : b.min), max(a.max >= b.max ? a.max : b.max) {}
+
+	float size() const {
+		return max - min;
+	}
 
 	bool contains(float x)  const {
 		return min <= x && x <= max;
@@ -16,6 +23,12 @@ public:
 		return min < x && x < max;
 	}
 
+	// widened by delta in total, half on each side
+	interval expand(float delta) const {
+		auto padding = delta / 2;
+		return interval(min - padding, max + padding);
+	}
+
 	float clamp(float x) const {
 		if (x < min) return min;
 		if (x > max) return max;
@@ -1,19 +1,30 @@
 #include "rtweekend.h"
+#include "animation.h"
+#include "arena.h"
+#include "bvh.h"
 #include "camera.h"
 #include "color.h"
+#include "distributed.h"
 #include "hittable_list.h"
 #include "material.h"
+#include "scene.h"
 #include "sphere.h"
+#include "wide_bvh.h"
 
-int main() {
-	
-	//World 
-	hittable_list world;
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// the cover scene, used when no scene file is given
+static void cover_scene(hittable_list& world, material_list& materials, camera& cam, bvh_layout layout) {
 	/*
-	auto material_ground = make_shared<lambertian>(color(.8f, .8f, .0f));
-	auto material_center = make_shared<lambertian>(color(.1f, .2f, .5f));
-	auto material_left = make_shared<dielectric>(1.5);
-	auto material_right = make_shared<metal>(color(.8f, .6f, .2f), 0.f);
+	auto material_ground = materials.add(lambertian(color(.8f, .8f, .0f)));
+	auto material_center = materials.add(lambertian(color(.1f, .2f, .5f)));
+	auto material_left = materials.add(dielectric(1.5));
+	auto material_right = materials.add(metal(color(.8f, .6f, .2f), 0.f));
 
 	world.add(make_shared<sphere>(point3(0.f, -100.5f, -1.f),  100, material_ground));
 	world.add(make_shared<sphere>(point3(0.f,     0.f, -1.f),  .5f, material_center));
@@ -22,8 +33,11 @@ int main() {
 	world.add(make_shared<sphere>(point3(1.f,     0.f, -1.f),  .5f, material_right));
 	*/
 
-	auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-	world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
+	// every sphere lives in one arena, freed in one go with the world
+	scene_arena arena;
+
+	auto ground_material = materials.add(lambertian(color(0.5, 0.5, 0.5)));
+	world.add(arena.make<sphere>(point3(0, -1000, 0), 1000, ground_material));
 
 	for (int a = -11; a < 11; a++) {
 		for (int b = -11; b < 11; b++) {
@@ -31,41 +45,43 @@ int main() {
 			point3 center(a + 0.9 * random_float(), 0.2, b + 0.9 * random_float());
 
 			if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-				shared_ptr<material> sphere_material;
+				uint32_t sphere_material;
 
 				if (choose_mat < 0.75) {
 					// diffuse
 					auto albedo = color::random() * color::random();
-					sphere_material = make_shared<lambertian>(albedo);
-					world.add(make_shared<sphere>(center, 0.2, sphere_material));
+					sphere_material = materials.add(lambertian(albedo));
+					world.add(arena.make<sphere>(center, 0.2, sphere_material));
 				}
 				else if (choose_mat < 0.90) {
 					// metal
 					auto albedo = color::random(0.5, 1);
 					auto fuzz = random_float(0, 0.5);
-					sphere_material = make_shared<metal>(albedo, fuzz);
-					world.add(make_shared<sphere>(center, 0.2, sphere_material));
+					sphere_material = materials.add(metal(albedo, fuzz));
+					world.add(arena.make<sphere>(center, 0.2, sphere_material));
 				}
 				else {
 					// glass
-					sphere_material = make_shared<dielectric>(1.5);
-					world.add(make_shared<sphere>(center, 0.2, sphere_material));
+					sphere_material = materials.add(dielectric(1.5));
+					world.add(arena.make<sphere>(center, 0.2, sphere_material));
 				}
 			}
 		}
 	}
 
-	auto material1 = make_shared<dielectric>(2.5f);
-	world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+	auto material1 = materials.add(dielectric(2.5f));
+	world.add(arena.make<sphere>(point3(0, 1, 0), 1.0, material1));
+
+	auto material2 = materials.add(lambertian(color(0.4, 0.2, 0.1)));
+	world.add(arena.make<sphere>(point3(-4, 1, 0), 1.0, material2));
 
-	auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-	world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+	auto material3 = materials.add(metal(color(0.7, 0.6, 0.5), 0.0));
+	world.add(arena.make<sphere>(point3(4, 1, 0), 1.0, material3));
 
-	auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-	world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+	// Acceleration structure
+	world = hittable_list(make_bvh(world, layout));
 
 	//Camera
-	camera cam;
 	cam.aspect_ratio = 16.0 / 9.0;
 	cam.image_width = 1200;
 	cam.samples_per_pixel = 500;
@@ -80,8 +96,118 @@ int main() {
 	cam.defocus_angle = .1f;
 	// focus_distance
 	cam.focus_dist = 10.f;
+}
+
+// raytracing [scene file] [--binary out.rtb] [--frames n] [--sampler independent|sobol|blue_noise]
+//            [--denoise] [--aovs] [--workers host:port,...] [--worker port] [--bvh binary|bvh4|bvh8]
+// Renders the scene file, text or ".rtb" binary, or the cover scene without one.
+// With --binary a text scene is converted to the binary form instead of rendered.
+// With --frames the camera flies once around lookat, one numbered image per frame.
+// --sampler picks the sample generator, see sampler_type.
+// --denoise filters the images, --aovs also writes the denoiser's guide images.
+// --workers renders the scene file on worker processes started with --worker, see distributed.h.
+// --bvh picks the node layout of the world BVH, that of the cover scene or a scene file's top level.
+int main(int argc, char** argv) {
+
+	std::string scene_file, binary_file;
+	int frames = 0;
+	sampler_type sampler = sampler_type::independent;
+	bool denoise = false, write_aovs = false;
+	std::vector<std::string> workers;
+	int worker_port = 0;
+	bvh_layout layout = bvh_layout::binary;
+	for (int k = 1; k < argc; k++) {
+		if (std::strcmp(argv[k], "--binary") == 0 && k + 1 < argc)
+			binary_file = argv[++k];
+		else if (std::strcmp(argv[k], "--frames") == 0 && k + 1 < argc)
+			frames = std::atoi(argv[++k]);
+		else if (std::strcmp(argv[k], "--sampler") == 0 && k + 1 < argc) {
+			std::string name = argv[++k];
+			if (name == "sobol") sampler = sampler_type::sobol;
+			else if (name == "blue_noise") sampler = sampler_type::blue_noise;
+			else if (name != "independent") {
+				std::cout << "Unknown sampler " << name << std::endl;
+				return 1;
+			}
+		}
+		else if (std::strcmp(argv[k], "--denoise") == 0)
+			denoise = true;
+		else if (std::strcmp(argv[k], "--aovs") == 0)
+			write_aovs = true;
+		else if (std::strcmp(argv[k], "--workers") == 0 && k + 1 < argc) {
+			std::stringstream list(argv[++k]);
+			std::string address;
+			while (std::getline(list, address, ','))
+				if (!address.empty()) workers.push_back(address);
+		}
+		else if (std::strcmp(argv[k], "--worker") == 0 && k + 1 < argc)
+			worker_port = std::atoi(argv[++k]);
+		else if (std::strcmp(argv[k], "--bvh") == 0 && k + 1 < argc) {
+			if (!parse_bvh_layout(argv[++k], layout)) {
+				std::cout << "Unknown BVH layout " << argv[k] << std::endl;
+				return 1;
+			}
+		}
+		else
+			scene_file = argv[k];
+	}
+
+	if (worker_port > 0)
+		return serve_render_jobs(worker_port) ? 0 : 1;
+
+	//World 
+	hittable_list world;
+	hittable_list lights;
+	material_list materials;
+	camera cam;
+
+	if (!binary_file.empty()) {
+		scene_description desc;
+		if (!read_scene_text(scene_file, desc) || !write_scene_binary(binary_file, desc)) {
+			std::cout << "Scene conversion error" << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	if (!scene_file.empty()) {
+		if (!load_scene(scene_file, world, lights, materials, cam, layout))
+			return 1;
+		if (!lights.objects.empty())
+			cam.lights = &lights;
+	}
+	else {
+		cover_scene(world, materials, cam, layout);
+	}
+	cam.sampler = sampler;
+	cam.denoise = denoise;
+	cam.write_aovs = write_aovs;
 
 	// Render
-	cam.render(world);
+	if (frames > 0) {
+		animation anim;
+		anim.frame_count = frames;
+
+		point3 center = cam.lookat;
+		vec3 offset = cam.lookfrom - cam.lookat;
+		vec3 axis = cam.vup;
+		anim.setup = [center, offset, axis, frames](int frame, animation_frame& state) {
+			state.lookfrom = center + transform::rotate(axis, 360.f * frame / frames).apply_vector(offset);
+		};
+
+		anim.render(cam, world, materials);
+	}
+	else if (!workers.empty()) {
+		std::vector<unsigned char> scene;
+		if (scene_file.empty()) {
+			std::cout << "Rendering on workers needs a scene file" << std::endl;
+			return 1;
+		}
+		if (!read_scene_bytes(scene_file, scene) || !render_distributed(cam, world, materials, scene, workers, 600, layout))
+			return 1;
+	}
+	else {
+		cam.render(world, materials);
+	}
 	
 }
\ No newline at end of file
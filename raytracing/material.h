@@ -4,65 +4,86 @@
 #include "rtweekend.h"
 #include "hittable_list.h"
 
-class hit_record;
+#include <cstdint>
+#include <vector>
+
+enum class material_type : uint32_t {
+	lambertian,
+	metal,
+	dielectric,
+	diffuse_light
+};
 
+// One plain struct for every material kind; scatter() switches on the type tag
+// instead of going through a virtual call.
 class material {
 public:
-	virtual ~material() = default;
+	material_type type = material_type::lambertian;
+	//Albedo is the fraction of light that a surface reflects. 
+	color albedo = color(0, 0, 0);
+	float fuzzy = 0; // metal only
+	float ir = 1; // Index of Refraction, dielectric only
+	color emission = color(0, 0, 0); // radiance leaving the front face, diffuse_light only
+
+	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+		switch (type) {
+		case material_type::metal:
+			return scatter_metal(r_in, rec, attenuation, scattered);
+		case material_type::dielectric:
+			return scatter_dielectric(r_in, rec, attenuation, scattered);
+		case material_type::diffuse_light:
+			return false;
+		default:
+			return scatter_lambertian(r_in, rec, attenuation, scattered);
+		}
+	}
 
-	virtual bool scatter(
-		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
-};
+	// lights are one sided, they emit on the side their normal points to
+	color emitted(const hit_record& rec) const {
+		if (type != material_type::diffuse_light || !rec.front_face)
+			return color(0, 0, 0);
+		return emission;
+	}
 
-class lambertian : public material {
-public:
-	lambertian(const color& a): albedo(a) {}
+	bool is_emissive() const { return type == material_type::diffuse_light; }
+
+	// lambertian is the only non-specular kind: light sampling only pays off there,
+	// and only there does the scatter direction have a density to weigh it against
+	bool is_diffuse() const { return type == material_type::lambertian; }
+
+	// density over solid angle of scatter_lambertian picking direction
+	static float lambertian_pdf(const hit_record& rec, const vec3& direction) {
+		auto cosine = dot(unit_vector(direction), rec.normal);
+		return cosine <= 0 ? 0.f : cosine / pi;
+	}
 
-	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) 
-	const override{
+	// the per-type kernels, also called directly on bins of one material type
+	bool scatter_lambertian(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+		RT_STATS_ADD(scatters[static_cast<int>(material_type::lambertian)], 1);
 		auto scatter_direction = rec.normal + random_unit_vector();
 
 		// catch degenerate the scatter_direction 
 		if (scatter_direction.near_zero())
 			scatter_direction = rec.normal;
 
-		scattered = ray(rec.p, scatter_direction);
+		scattered = ray(rec.p, scatter_direction, r_in.time());
 		attenuation = albedo;
 
 		return true;
 	}
-private:
-	//Albedo is the fraction of light that a surface reflects. 
-	color albedo;
-};
-
-class metal : public material {
-public:
-	metal(const color& a, float f) : albedo(a), fuzzy(f < 1 ? f : 1) {}
-
-	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
-		const override {
 
+	bool scatter_metal(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+		RT_STATS_ADD(scatters[static_cast<int>(material_type::metal)], 1);
 		vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
 
-		scattered = ray(rec.p, reflected + fuzzy * random_unit_vector());
+		scattered = ray(rec.p, reflected + fuzzy * random_unit_vector(), r_in.time());
 		attenuation = albedo;
 
 		return (dot(scattered.direction(), rec.normal) > 0);
-
 	}
-private:
-	color albedo;
-	float fuzzy;
-};
-
-class dielectric : public material {
-public:
-	dielectric(float index_of_refraction) : ir(index_of_refraction) {}
-
-	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
-		const override {
 
+	bool scatter_dielectric(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {
+		RT_STATS_ADD(scatters[static_cast<int>(material_type::dielectric)], 1);
 		attenuation = color(1.f, 1.f, 1.f);
 
 		// from air to the material, index of refraction of air is 1.0
@@ -81,14 +102,12 @@ public:
 		else
 			direction = refract(unit_direction, rec.normal, refraction_ratio);
 
-		scattered = ray(rec.p, direction);
+		scattered = ray(rec.p, direction, r_in.time());
 
 		return true;
-
 	}
-private:
-	float ir; // Index of Refraction
 
+private:
 	static float reflectance(float cosine, float ref_idx) {
 
 		// Use Schlick's approximation for reflectance
@@ -97,4 +116,49 @@ private:
 		return r0 + (1 - r0) * pow((1 - cosine), 5);
 	}
 };
+
+inline material lambertian(const color& a) {
+	material m;
+	m.type = material_type::lambertian;
+	m.albedo = a;
+	return m;
+}
+
+inline material metal(const color& a, float f) {
+	material m;
+	m.type = material_type::metal;
+	m.albedo = a;
+	m.fuzzy = f < 1 ? f : 1;
+	return m;
+}
+
+inline material diffuse_light(const color& emit) {
+	material m;
+	m.type = material_type::diffuse_light;
+	m.emission = emit;
+	return m;
+}
+
+inline material dielectric(float index_of_refraction) {
+	material m;
+	m.type = material_type::dielectric;
+	m.albedo = color(1.f, 1.f, 1.f);
+	m.ir = index_of_refraction;
+	return m;
+}
+
+// Scene-owned contiguous material table; primitives refer to entries by index
+class material_list {
+public:
+	std::vector<material> materials;
+
+	uint32_t add(const material& m) {
+		materials.push_back(m);
+		return static_cast<uint32_t>(materials.size() - 1);
+	}
+
+	const material& operator[](uint32_t index) const { return materials[index]; }
+
+	size_t size() const { return materials.size(); }
+};
 #endif // !MATERIAL_H
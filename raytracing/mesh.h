@@ -0,0 +1,274 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Triangle mesh over one shared vertex buffer. Triangles are three vertex indices,
+// and a flat per-mesh BVH over them keeps the whole mesh a single hittable.
+class triangle_mesh : public hittable {
+public:
+	triangle_mesh(std::vector<point3> _vertices, std::vector<uint32_t> _indices, uint32_t _material)
+		: vertices(std::move(_vertices)), indices(std::move(_indices)), mat(_material) {
+		build();
+	}
+
+	// Load the triangles of a Wavefront OBJ file, the format the rasterizer's Model reads.
+	static shared_ptr<triangle_mesh> load_obj(const std::string& filename, uint32_t material) {
+		std::vector<point3> verts;
+		std::vector<uint32_t> faces;
+		if (!read_obj(filename, verts, faces))
+			return nullptr;
+		return make_shared<triangle_mesh>(std::move(verts), std::move(faces), material);
+	}
+
+	// Vertices and triangle indices of an OBJ file. Polygons are split into fans;
+	// texture and normal indices are ignored. A face naming a vertex not defined before
+	// it fails the file, with its line.
+	static bool read_obj(const std::string& filename, std::vector<point3>& verts, std::vector<uint32_t>& faces) {
+		std::ifstream in(filename);
+		if (!in.is_open()) {
+			std::cerr << "Can not open " << filename << std::endl;
+			return false;
+		}
+
+		std::string line;
+		for (int line_number = 1; std::getline(in, line); line_number++) {
+			std::istringstream iss(line);
+			std::string tag;
+			iss >> tag;
+
+			if (tag == "v") {
+				float x, y, z;
+				iss >> x >> y >> z;
+				verts.push_back(point3(x, y, z));
+			}
+			else if (tag == "f") {
+				std::vector<uint32_t> polygon;
+				std::string corner;
+				while (iss >> corner) {
+					// "v", "v/vt", "v//vn" or "v/vt/vn": only the position index matters here
+					long index = std::strtol(corner.c_str(), nullptr, 10);
+					// in wavefront obj all indices start at 1, not zero; negative ones count from the end
+					index = index < 0 ? static_cast<long>(verts.size()) + index : index - 1;
+					if (index < 0 || index >= static_cast<long>(verts.size())) {
+						std::cerr << filename << ":" << line_number << ": face vertex " << corner << " does not exist" << std::endl;
+						return false;
+					}
+					polygon.push_back(static_cast<uint32_t>(index));
+				}
+				for (size_t k = 2; k < polygon.size(); k++) {
+					faces.push_back(polygon[0]);
+					faces.push_back(polygon[k - 1]);
+					faces.push_back(polygon[k]);
+				}
+			}
+		}
+
+		std::cerr << "# v# " << verts.size() << " f# " << faces.size() / 3 << std::endl;
+		return true;
+	}
+
+	size_t triangle_count() const { return indices.size() / 3; }
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		if (nodes.empty())
+			return false;
+
+		shear_ray sr(r);
+		vec3 dir = r.direction();
+
+		int best = -1;
+		int stack[max_depth + 2];
+		int top = 0;
+		stack[top++] = 0;
+
+		while (top > 0) {
+			const mesh_node& node = nodes[stack[--top]];
+			RT_STATS_ADD(bvh_node_visits, 1);
+			if (!node.box.hit(r, ray_t))
+				continue;
+
+			if (node.count > 0) {
+				RT_STATS_ADD(intersection_tests, node.count);
+				for (uint32_t k = node.start; k < node.start + node.count; k++) {
+					float t;
+					if (intersect(sr, k, ray_t, t)) {
+						ray_t.max = t;
+						best = static_cast<int>(k);
+					}
+				}
+			}
+			else {
+				// visit the child on the near side of the split first
+				int near_child = node.start, far_child = node.right;
+				if (dir[node.axis] < 0) std::swap(near_child, far_child);
+				stack[top++] = far_child;
+				stack[top++] = near_child;
+			}
+		}
+
+		if (best < 0)
+			return false;
+
+		const point3& v0 = vertices[indices[3 * best]];
+		const point3& v1 = vertices[indices[3 * best + 1]];
+		const point3& v2 = vertices[indices[3 * best + 2]];
+
+		rec.t = ray_t.max;
+		rec.p = r.at(rec.t);
+		rec.set_face_normal(r, unit_vector(cross(v1 - v0, v2 - v0)));
+		rec.mat = mat;
+
+		return true;
+	}
+
+	aabb bounding_box() const override { return nodes.empty() ? aabb() : nodes[0].box; }
+
+private:
+	// Interior nodes keep the left child right after them; leaves own [start, start + count)
+	struct mesh_node {
+		aabb box;
+		int start; // first triangle of a leaf, left child of an interior node
+		int right; // right child of an interior node
+		uint32_t count; // triangles in a leaf, 0 for interior nodes
+		int axis; // split axis of an interior node
+	};
+
+	static const uint32_t leaf_size = 4;
+	static const int max_depth = 126; // bounds the traversal stack
+
+	std::vector<point3> vertices;
+	std::vector<uint32_t> indices; // three per triangle, reordered to BVH leaf order
+	std::vector<mesh_node> nodes;
+	uint32_t mat;
+
+	// Per-ray constants of the watertight test (Woop, Benthin, Wald 2013): the ray is
+	// sheared so that it runs along +z through the origin, the dominant axis last.
+	struct shear_ray {
+		point3 origin;
+		int kx, ky, kz;
+		float sx, sy, sz;
+
+		shear_ray(const ray& r) : origin(r.origin()) {
+			vec3 d = r.direction();
+			kz = fabs(d.x()) > fabs(d.y()) ? (fabs(d.x()) > fabs(d.z()) ? 0 : 2) : (fabs(d.y()) > fabs(d.z()) ? 1 : 2);
+			kx = (kz + 1) % 3;
+			ky = (kx + 1) % 3;
+			// keep the winding of the triangles
+			if (d[kz] < 0) std::swap(kx, ky);
+
+			sx = d[kx] / d[kz];
+			sy = d[ky] / d[kz];
+			sz = 1.f / d[kz];
+		}
+	};
+
+	bool intersect(const shear_ray& sr, uint32_t tri, const interval& ray_t, float& t) const {
+		vec3 a = vertices[indices[3 * tri]] - sr.origin;
+		vec3 b = vertices[indices[3 * tri + 1]] - sr.origin;
+		vec3 c = vertices[indices[3 * tri + 2]] - sr.origin;
+
+		float ax = a[sr.kx] - sr.sx * a[sr.kz], ay = a[sr.ky] - sr.sy * a[sr.kz];
+		float bx = b[sr.kx] - sr.sx * b[sr.kz], by = b[sr.ky] - sr.sy * b[sr.kz];
+		float cx = c[sr.kx] - sr.sx * c[sr.kz], cy = c[sr.ky] - sr.sy * c[sr.kz];
+
+		float u = cx * by - cy * bx;
+		float v = ax * cy - ay * cx;
+		float w = bx * ay - by * ax;
+
+		// on an edge: redo the edge functions in double so neighbours never both miss
+		if (u == 0.f || v == 0.f || w == 0.f) {
+			u = static_cast<float>(static_cast<double>(cx) * by - static_cast<double>(cy) * bx);
+			v = static_cast<float>(static_cast<double>(ax) * cy - static_cast<double>(ay) * cx);
+			w = static_cast<float>(static_cast<double>(bx) * ay - static_cast<double>(by) * ax);
+		}
+
+		if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+			return false;
+
+		float det = u + v + w;
+		if (det == 0.f)
+			return false;
+
+		float az = sr.sz * a[sr.kz], bz = sr.sz * b[sr.kz], cz = sr.sz * c[sr.kz];
+		t = (u * az + v * bz + w * cz) / det;
+
+		return ray_t.surrounds(t);
+	}
+
+	void build() {
+		size_t count = indices.size() / 3;
+		if (count == 0) return;
+
+		std::vector<bvh_primitive> prims(count);
+		for (size_t k = 0; k < count; k++) {
+			const point3& v0 = vertices[indices[3 * k]];
+			prims[k].box = aabb(aabb(v0, vertices[indices[3 * k + 1]]), aabb(v0, vertices[indices[3 * k + 2]]));
+			prims[k].centroid = prims[k].box.centroid();
+			prims[k].index = static_cast<int>(k);
+		}
+
+		nodes.reserve(2 * count / leaf_size + 1);
+		build_node(prims, 0, count, 0);
+
+		// store the triangles in leaf order, so every leaf is one contiguous run
+		std::vector<uint32_t> ordered(indices.size());
+		for (size_t k = 0; k < count; k++)
+			for (int c = 0; c < 3; c++)
+				ordered[3 * k + c] = indices[3 * prims[k].index + c];
+		indices.swap(ordered);
+	}
+
+	int build_node(std::vector<bvh_primitive>& prims, size_t start, size_t end, int depth) {
+		int index = static_cast<int>(nodes.size());
+		nodes.push_back(mesh_node());
+
+		aabb box;
+		for (size_t k = start; k < end; k++)
+			box = aabb(box, prims[k].box);
+		nodes[index].box = box;
+
+		if (end - start <= leaf_size) {
+			nodes[index].start = static_cast<int>(start);
+			nodes[index].count = static_cast<uint32_t>(end - start);
+			return index;
+		}
+
+		aabb centroids;
+		for (size_t k = start; k < end; k++)
+			centroids = aabb(centroids, aabb(prims[k].centroid, prims[k].centroid));
+		int axis = centroids.longest_axis();
+
+		// past half the depth budget fall back to median splits, which halve the count every level
+		size_t mid;
+		if (depth < max_depth / 2) {
+			mid = sah_partition(prims, start, end);
+		}
+		else {
+			mid = start + (end - start) / 2;
+			std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+				[axis](const bvh_primitive& a, const bvh_primitive& b) { return a.centroid[axis] < b.centroid[axis]; });
+		}
+
+		int left = build_node(prims, start, mid, depth + 1);
+		int right = build_node(prims, mid, end, depth + 1);
+		nodes[index].start = left;
+		nodes[index].right = right;
+		nodes[index].count = 0;
+		nodes[index].axis = axis;
+		return index;
+	}
+};
+
+#endif // !MESH_H
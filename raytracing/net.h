@@ -0,0 +1,220 @@
+#ifndef NET_H
+#define NET_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+// Blocking TCP connection: whole buffers in and out, every failure (peer gone, timeout)
+// reported as false, after which the connection is closed and stays so.
+class tcp_connection {
+public:
+#if defined(_WIN32)
+	typedef SOCKET handle_type;
+	static constexpr handle_type invalid_handle = INVALID_SOCKET;
+#else
+	typedef int handle_type;
+	static constexpr handle_type invalid_handle = -1;
+#endif
+
+	tcp_connection() {}
+	explicit tcp_connection(handle_type h) : handle(h) { no_delay(); }
+	tcp_connection(const tcp_connection&) = delete;
+	tcp_connection& operator=(const tcp_connection&) = delete;
+	tcp_connection(tcp_connection&& other) noexcept : handle(other.handle) { other.handle = invalid_handle; }
+	tcp_connection& operator=(tcp_connection&& other) noexcept {
+		if (this != &other) {
+			close();
+			handle = other.handle;
+			other.handle = invalid_handle;
+		}
+		return *this;
+	}
+	~tcp_connection() { close(); }
+
+	// "host:port", host a name or an address
+	bool connect(const std::string& address) {
+		close();
+		if (!net_startup()) return false;
+		auto colon = address.find_last_of(':');
+		if (colon == std::string::npos) return false;
+		std::string host = address.substr(0, colon), port = address.substr(colon + 1);
+
+		addrinfo hints;
+		std::memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo* found = nullptr;
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) return false;
+
+		for (addrinfo* a = found; a && handle == invalid_handle; a = a->ai_next) {
+			handle = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+			if (handle == invalid_handle) continue;
+			if (::connect(handle, a->ai_addr, static_cast<int>(a->ai_addrlen)) != 0)
+				close();
+		}
+		freeaddrinfo(found);
+		no_delay();
+		return is_open();
+	}
+
+	bool is_open() const { return handle != invalid_handle; }
+
+	// seconds a send or receive may stall before it fails, 0 waits forever
+	void set_timeout(int seconds) {
+		if (!is_open()) return;
+#if defined(_WIN32)
+		DWORD t = static_cast<DWORD>(seconds) * 1000;
+#else
+		timeval t;
+		t.tv_sec = seconds;
+		t.tv_usec = 0;
+#endif
+		setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&t), sizeof(t));
+		setsockopt(handle, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&t), sizeof(t));
+	}
+
+	bool send_all(const void* data, size_t bytes) {
+		const char* p = static_cast<const char*>(data);
+		while (bytes > 0 && is_open()) {
+			int chunk = static_cast<int>(bytes < (1u << 30) ? bytes : (1u << 30));
+#if defined(_WIN32)
+			int sent = ::send(handle, p, chunk, 0);
+#else
+			int sent = static_cast<int>(::send(handle, p, chunk, MSG_NOSIGNAL));
+#endif
+			if (sent <= 0) {
+				close();
+				return false;
+			}
+			p += sent;
+			bytes -= sent;
+		}
+		return is_open();
+	}
+
+	bool receive_all(void* data, size_t bytes) {
+		char* p = static_cast<char*>(data);
+		while (bytes > 0 && is_open()) {
+			int chunk = static_cast<int>(bytes < (1u << 30) ? bytes : (1u << 30));
+			int got = static_cast<int>(::recv(handle, p, chunk, 0));
+			if (got <= 0) {
+				close();
+				return false;
+			}
+			p += got;
+			bytes -= got;
+		}
+		return is_open();
+	}
+
+	template <typename T>
+	bool send_value(const T& value) { return send_all(&value, sizeof(T)); }
+
+	template <typename T>
+	bool receive_value(T& value) { return receive_all(&value, sizeof(T)); }
+
+	void close() {
+		if (!is_open()) return;
+#if defined(_WIN32)
+		closesocket(handle);
+#else
+		::close(handle);
+#endif
+		handle = invalid_handle;
+	}
+
+	// winsock wants one start before any socket call, other systems need nothing
+	static bool net_startup() {
+#if defined(_WIN32)
+		static const bool started = [] {
+			WSADATA data;
+			return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+		}();
+		return started;
+#else
+		return true;
+#endif
+	}
+
+private:
+	handle_type handle = invalid_handle;
+
+	// requests and replies are small and answered at once, do not hold them back
+	void no_delay() {
+		if (!is_open()) return;
+		int on = 1;
+		setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+	}
+};
+
+// Listening TCP socket on every interface
+class tcp_listener {
+public:
+	tcp_listener() {}
+	tcp_listener(const tcp_listener&) = delete;
+	tcp_listener& operator=(const tcp_listener&) = delete;
+	~tcp_listener() { close(); }
+
+	bool listen(int port) {
+		close();
+		if (!tcp_connection::net_startup()) return false;
+		handle = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (handle == tcp_connection::invalid_handle) return false;
+
+		// a restarted worker gets its port back at once
+		int on = 1;
+		setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on));
+
+		sockaddr_in address;
+		std::memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		address.sin_port = htons(static_cast<unsigned short>(port));
+		if (::bind(handle, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+			|| ::listen(handle, 8) != 0) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	// wait for the next peer; an invalid connection on failure
+	tcp_connection accept() {
+		if (handle == tcp_connection::invalid_handle) return tcp_connection();
+		tcp_connection::handle_type peer = ::accept(handle, nullptr, nullptr);
+		if (peer == tcp_connection::invalid_handle) return tcp_connection();
+		return tcp_connection(peer);
+	}
+
+	void close() {
+		if (handle == tcp_connection::invalid_handle) return;
+#if defined(_WIN32)
+		closesocket(handle);
+#else
+		::close(handle);
+#endif
+		handle = tcp_connection::invalid_handle;
+	}
+
+private:
+	tcp_connection::handle_type handle = tcp_connection::invalid_handle;
+};
+
+#endif // !NET_H
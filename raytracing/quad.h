@@ -0,0 +1,87 @@
+#ifndef QUAD_H
+#define QUAD_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+
+#include <cstdint>
+
+// Parallelogram spanned by the edges u and v from the corner Q. The front face is the
+// side cross(u, v) points to, which is also the side an emissive quad lights.
+class quad : public hittable {
+public:
+	quad(const point3& _Q, const vec3& _u, const vec3& _v, uint32_t _material)
+		: Q(_Q), u(_u), v(_v), mat(_material) {
+		auto n = cross(u, v);
+		normal = unit_vector(n);
+		D = dot(normal, Q);
+		w = n / dot(n, n);
+		area = n.length();
+
+		bbox = aabb(aabb(Q, Q + u + v), aabb(Q + u, Q + v));
+		bbox.pad_to_minimums();
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		RT_STATS_ADD(intersection_tests, 1);
+		auto denom = dot(normal, r.direction());
+
+		// parallel to the plane
+		if (fabs(denom) < 1e-8f)
+			return false;
+
+		auto t = (D - dot(normal, r.origin())) / denom;
+		if (!ray_t.surrounds(t))
+			return false;
+
+		// plane coordinates of the hit point in the (u, v) frame
+		auto intersection = r.at(t);
+		vec3 planar = intersection - Q;
+		auto alpha = dot(w, cross(planar, v));
+		auto beta = dot(w, cross(u, planar));
+		if (alpha < 0 || alpha > 1 || beta < 0 || beta > 1)
+			return false;
+
+		rec.t = t;
+		rec.p = intersection;
+		rec.set_face_normal(r, normal);
+		rec.mat = mat;
+
+		return true;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	// as a light: points are drawn uniformly over the area, converted to solid angle here
+	float pdf_value(const point3& origin, const vec3& direction, float time) const override {
+		hit_record rec;
+		if (!hit(ray(origin, direction, time), interval(0.001f, infinity), rec))
+			return 0.f;
+
+		auto distance_squared = rec.t * rec.t * direction.length_squared();
+		auto cosine = fabs(dot(direction, normal) / direction.length());
+		if (cosine <= 0.f)
+			return 0.f;
+		return distance_squared / (cosine * area);
+	}
+
+	vec3 random(const point3& origin, float /*time*/) const override {
+		float a, b;
+		random_float2(a, b);
+		auto p = Q + (a * u) + (b * v);
+		return p - origin;
+	}
+
+private:
+	point3 Q;
+	vec3 u, v;
+	vec3 w; // n / n.n, turns plane points into (u, v) coordinates
+	vec3 normal;
+	float D; // plane equation dot(normal, p) = D
+	float area;
+	uint32_t mat;
+	aabb bbox;
+};
+
+#endif // !QUAD_H
@@ -0,0 +1,78 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+
+// Small, fast random engines. Both expose the same interface, so the generator used by
+// random_float() can be picked at compile time (see random_generator below).
+
+// PCG32 (XSH RR variant): 64 bit LCG state, one independent stream per odd increment
+class pcg32 {
+public:
+	pcg32() { seed(0, 0); }
+
+	void seed(uint64_t seed, uint64_t sequence) {
+		state = 0u;
+		inc = (sequence << 1u) | 1u;
+		next();
+		state += seed;
+		next();
+	}
+
+	uint32_t next() {
+		uint64_t old = state;
+		state = old * 6364136223846793005ull + inc;
+		uint32_t xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+		uint32_t rot = static_cast<uint32_t>(old >> 59u);
+		return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+	}
+
+private:
+	uint64_t state;
+	uint64_t inc;
+};
+
+// xoshiro128+: 128 bit state, the upper bits are the high quality ones
+class xoshiro128plus {
+public:
+	xoshiro128plus() { seed(0, 0); }
+
+	void seed(uint64_t seed, uint64_t sequence) {
+		// splitmix64 expands the seed pair into a state that is never all zero
+		uint64_t x = seed ^ (sequence * 0x9e3779b97f4a7c15ull);
+		for (int i = 0; i < 2; i++) {
+			uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			z ^= z >> 31;
+			s[2 * i] = static_cast<uint32_t>(z);
+			s[2 * i + 1] = static_cast<uint32_t>(z >> 32);
+		}
+	}
+
+	uint32_t next() {
+		uint32_t result = s[0] + s[3];
+		uint32_t t = s[1] << 9;
+
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = (s[3] << 11) | (s[3] >> 21);
+
+		return result;
+	}
+
+private:
+	uint32_t s[4];
+};
+
+// Define RT_RANDOM_XOSHIRO128PLUS to swap the engine behind random_float()
+#if defined(RT_RANDOM_XOSHIRO128PLUS)
+using random_generator = xoshiro128plus;
+#else
+using random_generator = pcg32;
+#endif
+
+#endif // !RANDOM_H
@@ -6,10 +6,12 @@
 class ray {
 public:
 	ray(){}
-	ray(const point3& origin, const vec3& direction): orig(origin), dir(direction){}
+	ray(const point3& origin, const vec3& direction): orig(origin), dir(direction), tm(0){}
+	ray(const point3& origin, const vec3& direction, float time): orig(origin), dir(direction), tm(time){}
 	
 	point3 origin() const { return orig; }
 	vec3 direction() const { return dir; }
+	float time() const { return tm; } // moment within the shutter interval the ray samples
 
 	point3 at(float t) const {
 		return orig + t * dir;
@@ -19,6 +21,7 @@ public:
 private:
 	point3 orig;
 	vec3 dir;
+	float tm = 0;
 };
 
 #endif // !RAY_H
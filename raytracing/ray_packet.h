@@ -0,0 +1,35 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "rtweekend.h"
+
+// Up to 16 coherent rays in structure of arrays layout, traced through the scene together.
+// Lanes are selected with bit masks: bit l set means lane l takes part.
+struct ray_packet {
+	static const int max_size = 16;
+
+	int size = 0;
+	// unused lanes stay zero, so lane loops may run over all max_size of them
+	float ox[max_size] = {}, oy[max_size] = {}, oz[max_size] = {};
+	float dx[max_size] = {}, dy[max_size] = {}, dz[max_size] = {};
+	float inv_dx[max_size] = {}, inv_dy[max_size] = {}, inv_dz[max_size] = {};
+	float time[max_size] = {};
+	float tmin = 0.001f;
+	float tmax[max_size] = {}; // closest hit so far of every lane
+
+	void set(int lane, const ray& r) {
+		point3 o = r.origin();
+		vec3 d = r.direction();
+		ox[lane] = o.x(); oy[lane] = o.y(); oz[lane] = o.z();
+		dx[lane] = d.x(); dy[lane] = d.y(); dz[lane] = d.z();
+		inv_dx[lane] = 1.f / d.x(); inv_dy[lane] = 1.f / d.y(); inv_dz[lane] = 1.f / d.z();
+		time[lane] = r.time();
+		tmax[lane] = infinity;
+	}
+
+	ray get(int lane) const {
+		return ray(point3(ox[lane], oy[lane], oz[lane]), vec3(dx[lane], dy[lane], dz[lane]), time[lane]);
+	}
+};
+
+#endif // !RAY_PACKET_H
@@ -6,6 +6,9 @@
 #include <limits>
 #include <memory>
 
+#include "random.h"
+#include "sampler.h"
+
 //Using 
 using std::shared_ptr;
 using std::make_shared;
@@ -20,8 +23,43 @@ inline float degrees_to_radians(float degrees) {
 	return degrees * pi / 180.f;
 }
 
+// Every thread owns its own generator, so parallel renders neither race nor serialize on it
+inline random_generator& random_engine() {
+	thread_local random_generator engine;
+	return engine;
+}
+
+// Restart the calling thread's random sequence. Different sequence values give
+// independent streams for the same seed, e.g. one per pixel or tile.
+inline void seed_random(uint64_t seed, uint64_t sequence = 0) {
+	random_engine().seed(seed, sequence);
+}
+
+// The calling thread's place in a low-discrepancy sequence, see sample_sequence. Left
+// independent, random_float() draws from random_engine().
+inline sample_sequence& sample_stream() {
+	thread_local sample_sequence sequence;
+	return sequence;
+}
+
 inline float random_float() {
-	return rand() / (RAND_MAX + 1.0);
+	sample_sequence& sequence = sample_stream();
+	if (sequence.type != sampler_type::independent)
+		return sequence.next_1d();
+	// keep 24 bits so the result never rounds up to 1
+	return (random_engine().next() >> 8) * (1.f / 16777216.f);
+}
+
+// Two numbers for one 2D decision: a position in the pixel, on the lens or on a light,
+// or a direction. Low-discrepancy samplers stratify the pair jointly.
+inline void random_float2(float& u, float& v) {
+	sample_sequence& sequence = sample_stream();
+	if (sequence.type != sampler_type::independent) {
+		sequence.next_2d(u, v);
+		return;
+	}
+	u = random_float();
+	v = random_float();
 }
 
 inline float random_float(float min, float max) {
@@ -0,0 +1,215 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "random.h"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Sample generators behind random_float(). Independent sampling draws from the per-pixel
+// random_generator; the other two hand out the coordinates of low-discrepancy points,
+// one dimension per call, which converge faster than independent numbers.
+enum class sampler_type {
+	independent, // uniform random numbers
+	sobol, // Owen scrambled Sobol points, scrambled differently in every pixel
+	blue_noise, // one Owen scrambled Sobol sequence for all pixels, shifted per pixel by a blue noise mask
+};
+
+inline uint32_t reverse_bits(uint32_t x) {
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+// 32 bit integer hash (lowbias32), for seeds of the scrambles
+inline uint32_t mix_bits(uint32_t x) {
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+// Owen scrambling by hashing (Burley 2020, "Practical Hash-based Owen Scrambling"): every
+// bit is flipped depending only on the bits above it, which keeps the stratification of
+// the points while decorrelating different seeds.
+inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+	x = reverse_bits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return reverse_bits(x);
+}
+
+// The first two Sobol dimensions, as 0.32 fixed point
+inline uint32_t sobol_0(uint32_t index) { return reverse_bits(index); }
+
+inline uint32_t sobol_1(uint32_t index) {
+	uint32_t result = 0;
+	for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+		if (index & 1u) result ^= v;
+	return result;
+}
+
+// 64x64 blue noise ranks from the void and cluster method (Ulichney 1993), generated once
+// on first use. Ranks of neighbouring texels differ as much as possible, so using them
+// as per-pixel offsets leaves an error that looks like high frequency noise.
+inline std::vector<uint16_t> make_blue_noise_mask() {
+	const int size = 64, n = size * size;
+	const float sigma = 1.9f;
+
+	// toroidal Gaussian around texel 0
+	std::vector<float> kernel(n);
+	for (int y = 0; y < size; y++)
+		for (int x = 0; x < size; x++) {
+			int dx = x < size / 2 ? x : size - x;
+			int dy = y < size / 2 ? y : size - y;
+			kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+		}
+
+	std::vector<float> energy(n, 0.f);
+	std::vector<unsigned char> on(n, 0);
+	auto toggle = [&](int p) {
+		float sign = on[p] ? -1.f : 1.f;
+		on[p] = !on[p];
+		int px = p % size, py = p / size;
+		for (int y = 0; y < size; y++)
+			for (int x = 0; x < size; x++)
+				energy[y * size + x] += sign * kernel[((y - py) & (size - 1)) * size + ((x - px) & (size - 1))];
+	};
+	auto tightest_cluster = [&]() {
+		int best = -1;
+		for (int p = 0; p < n; p++)
+			if (on[p] && (best < 0 || energy[p] > energy[best])) best = p;
+		return best;
+	};
+	auto largest_void = [&]() {
+		int best = -1;
+		for (int p = 0; p < n; p++)
+			if (!on[p] && (best < 0 || energy[p] < energy[best])) best = p;
+		return best;
+	};
+
+	// initial pattern: a tenth of the texels at random, relaxed until moving the point of
+	// the tightest cluster into the largest void would put it back where it was
+	pcg32 rng;
+	rng.seed(0x5eed, 0);
+	int ones = 0;
+	while (ones < n / 10) {
+		int p = static_cast<int>(rng.next() % n);
+		if (!on[p]) {
+			toggle(p);
+			ones++;
+		}
+	}
+	for (;;) {
+		int cluster = tightest_cluster();
+		toggle(cluster);
+		int hole = largest_void();
+		toggle(hole);
+		if (hole == cluster) break;
+	}
+
+	std::vector<unsigned char> initial = on;
+	std::vector<float> initial_energy = energy;
+	std::vector<uint16_t> rank(n);
+
+	// the initial points get the low ranks, tightest clusters first to go
+	for (int r = ones - 1; r >= 0; r--) {
+		int cluster = tightest_cluster();
+		toggle(cluster);
+		rank[cluster] = static_cast<uint16_t>(r);
+	}
+
+	// the rest fill up the largest voids
+	on = initial;
+	energy = initial_energy;
+	for (int r = ones; r < n; r++) {
+		int hole = largest_void();
+		toggle(hole);
+		rank[hole] = static_cast<uint16_t>(r);
+	}
+	return rank;
+}
+
+inline const std::vector<uint16_t>& blue_noise_mask() {
+	static const std::vector<uint16_t> mask = make_blue_noise_mask();
+	return mask;
+}
+
+// Where one pixel sample stands in its low-discrepancy sequence. Dimensions are handed out
+// in call order, but from fixed starting points: the camera owns the first ones (pixel
+// position, lens, time), and every bounce starts at its own block, so the dimension a
+// decision gets does not depend on how many numbers the bounces before it took. Any
+// dimension exists: Sobol points are padded (Kollig and Keller 2002) by shuffling the
+// sample order per dimension pair, so that pairs stay uncorrelated.
+struct sample_sequence {
+	static const uint32_t camera_dimensions = 6;
+	static const uint32_t bounce_dimensions = 8;
+
+	sampler_type type = sampler_type::independent;
+	uint32_t seed = 0; // scrambles the points of one pixel (sobol) or of the whole image (blue noise)
+	uint32_t index = 0; // sample number within the pixel
+	uint32_t dimension = 0;
+	uint32_t pixel_x = 0, pixel_y = 0;
+	const uint16_t* mask = nullptr; // blue noise ranks, only when dithering
+
+	// deterministic per pixel and sample number, whichever thread and pass takes the sample
+	void start(sampler_type _type, uint32_t image_seed, int x, int y, int sample_index) {
+		type = _type;
+		pixel_x = static_cast<uint32_t>(x);
+		pixel_y = static_cast<uint32_t>(y);
+		index = static_cast<uint32_t>(sample_index);
+		dimension = 0;
+		seed = mix_bits(image_seed + 0x9e3779b9u);
+		if (type == sampler_type::sobol)
+			seed = mix_bits(seed ^ mix_bits(pixel_x * 0x8da6b343u ^ pixel_y * 0xd8163841u));
+		mask = type == sampler_type::blue_noise ? blue_noise_mask().data() : nullptr;
+	}
+
+	void start_bounce(int bounce) {
+		dimension = camera_dimensions + static_cast<uint32_t>(bounce) * bounce_dimensions;
+	}
+
+	float next_1d() {
+		uint32_t d = dimension++;
+		uint32_t hash = mix_bits(seed ^ mix_bits(d));
+		uint32_t i = nested_uniform_scramble(index, hash);
+		return to_float(nested_uniform_scramble(sobol_0(i), mix_bits(hash + 1)) + shift(d));
+	}
+
+	// a 2D point stratified in both coordinates, from an aligned pair of dimensions
+	void next_2d(float& u, float& v) {
+		uint32_t d = (dimension + 1) & ~1u;
+		dimension = d + 2;
+		uint32_t hash = mix_bits(seed ^ mix_bits(d));
+		uint32_t i = nested_uniform_scramble(index, hash);
+		u = to_float(nested_uniform_scramble(sobol_0(i), mix_bits(hash + 1)) + shift(d));
+		v = to_float(nested_uniform_scramble(sobol_1(i), mix_bits(hash + 2)) + shift(d + 1));
+	}
+
+private:
+	// keep 24 bits so the result never rounds up to 1
+	static float to_float(uint32_t x) { return (x >> 8) * (1.f / 16777216.f); }
+
+	// Blue noise dithering (Georgiev and Fajardo 2016): every pixel shifts the shared
+	// points by a mask value, modulo 1, and every dimension reads the mask at its own
+	// offset. Neighbouring pixels then get the most different shifts.
+	uint32_t shift(uint32_t d) const {
+		if (!mask)
+			return 0;
+		uint32_t offset = mix_bits(seed + d);
+		uint32_t x = (pixel_x + offset) & 63u;
+		uint32_t y = (pixel_y + (offset >> 8)) & 63u;
+		return (static_cast<uint32_t>(mask[y * 64 + x]) << 20) + (1u << 19);
+	}
+};
+
+#endif // !SAMPLER_H
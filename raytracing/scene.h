@@ -0,0 +1,599 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "rtweekend.h"
+
+#include "arena.h"
+#include "bvh.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "mesh.h"
+#include "quad.h"
+#include "sphere.h"
+#include "sphere_soup.h"
+#include "transform.h"
+#include "wide_bvh.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Scene files, so scenes change without recompiling. The text form is line based like OBJ:
+//
+//   # comment
+//   image_width 1200
+//   aspect_ratio 1.7778
+//   samples_per_pixel 500
+//   max_depth 50
+//   vfov 20
+//   lookfrom 13 2 3
+//   lookat 0 0 0
+//   vup 0 1 0
+//   defocus_angle 0.1
+//   focus_dist 10
+//   sky 1
+//   material <name> lambertian <r g b> | metal <r g b> <fuzz> | dielectric <ir> | light <r g b>
+//   sphere <x y z> <radius> <material>
+//   quad <corner x y z> <edge u x y z> <edge v x y z> <material>
+//   mesh <name> <file.obj> <material>
+//   instance <mesh> [material <name>] [translate <x y z>] [rotate <axis x y z> <degrees>] [scale <s> | <x y z>]
+//
+// Spheres and quads with a light material are also sampled as lights; a quad lights the
+// side cross(u, v) points to. sky 0 turns the sky off, for scenes lit by their lights only.
+// A mesh line only loads the geometry, every instance line places one copy of it. The
+// transforms of an instance apply in the order written. OBJ paths are relative to the
+// scene file. The binary form (".rtb") stores the same records as flat arrays, meshes
+// included, and is memory mapped on load.
+
+// Camera settings of a scene, defaults as in camera. focus_dist 0 focuses on lookat.
+struct scene_camera {
+	int32_t image_width = 100;
+	float aspect_ratio = 1.f;
+	int32_t samples_per_pixel = 10;
+	int32_t max_depth = 10;
+	float vfov = 90;
+	float lookfrom[3] = { 0, 0, -1 };
+	float lookat[3] = { 0, 0, 0 };
+	float vup[3] = { 0, 1, 0 };
+	float defocus_angle = 0;
+	float focus_dist = 0;
+	int32_t sky = 1;
+
+	void apply(camera& cam) const {
+		cam.image_width = image_width;
+		cam.aspect_ratio = aspect_ratio;
+		cam.samples_per_pixel = samples_per_pixel;
+		cam.max_depth = max_depth;
+		cam.vfov = vfov;
+		cam.lookfrom = point3(lookfrom[0], lookfrom[1], lookfrom[2]);
+		cam.lookat = point3(lookat[0], lookat[1], lookat[2]);
+		cam.vup = vec3(vup[0], vup[1], vup[2]);
+		cam.defocus_angle = defocus_angle;
+		cam.focus_dist = focus_dist > 0 ? focus_dist : (cam.lookfrom - cam.lookat).length();
+		cam.sky = sky != 0;
+	}
+
+	// the reverse of apply, to hand a camera set up in code to other processes
+	void capture(const camera& cam) {
+		image_width = cam.image_width;
+		aspect_ratio = cam.aspect_ratio;
+		samples_per_pixel = cam.samples_per_pixel;
+		max_depth = cam.max_depth;
+		vfov = cam.vfov;
+		for (int k = 0; k < 3; k++) {
+			lookfrom[k] = cam.lookfrom[k];
+			lookat[k] = cam.lookat[k];
+			vup[k] = cam.vup[k];
+		}
+		defocus_angle = cam.defocus_angle;
+		focus_dist = cam.focus_dist;
+		sky = cam.sky ? 1 : 0;
+	}
+};
+
+// Records of the binary file. Every field is 4 bytes wide, so the arrays stay aligned
+// in the mapping and read back as they are.
+struct scene_material {
+	uint32_t type; // material_type
+	float albedo[3]; // emission of lights
+	float fuzzy;
+	float ir;
+};
+
+struct scene_sphere {
+	float center[3];
+	float radius;
+	uint32_t material;
+};
+
+struct scene_quad {
+	float corner[3];
+	float u[3];
+	float v[3];
+	uint32_t material;
+};
+
+struct scene_mesh {
+	uint32_t vertex_count;
+	uint32_t index_count; // three per triangle, relative to the mesh's own vertices
+	uint32_t material;
+};
+
+struct scene_instance {
+	uint32_t mesh;
+	uint32_t material; // instance::keep_material keeps the mesh's material
+	float m[3][4];
+};
+
+struct scene_file_header {
+	char magic[4] = { 'R', 'T', 'S', 'C' };
+	uint32_t version = 2;
+	uint32_t material_count = 0;
+	uint32_t sphere_count = 0;
+	uint32_t quad_count = 0;
+	uint32_t mesh_count = 0;
+	uint32_t vertex_count = 0; // over all meshes
+	uint32_t index_count = 0; // over all meshes
+	uint32_t instance_count = 0;
+	scene_camera camera;
+};
+
+// A whole scene as flat arrays; file layout is the header followed by these in order
+struct scene_description {
+	scene_camera camera;
+	std::vector<scene_material> materials;
+	std::vector<scene_sphere> spheres;
+	std::vector<scene_quad> quads;
+	std::vector<scene_mesh> meshes;
+	std::vector<float> vertices; // xyz, the meshes one after another
+	std::vector<uint32_t> indices; // the meshes one after another
+	std::vector<scene_instance> instances;
+};
+
+// Parse a text scene file; errors name the line and leave desc partly filled
+inline bool read_scene_text(const std::string& filename, scene_description& desc) {
+	std::ifstream in(filename);
+	if (!in.is_open()) {
+		std::cerr << "Can not open " << filename << std::endl;
+		return false;
+	}
+
+	size_t slash = filename.find_last_of("/\\");
+	std::string directory = slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+
+	std::map<std::string, uint32_t> material_names;
+	std::map<std::string, uint32_t> mesh_names;
+	scene_camera& cam = desc.camera;
+
+	std::string line;
+	for (int line_number = 1; std::getline(in, line); line_number++) {
+		auto fail = [&](const std::string& what) {
+			std::cerr << filename << ":" << line_number << ": " << what << std::endl;
+			return false;
+		};
+
+		std::istringstream iss(line);
+		std::string tag;
+		if (!(iss >> tag) || tag[0] == '#')
+			continue;
+
+		auto find_material = [&](const std::string& name, uint32_t& index) {
+			auto it = material_names.find(name);
+			if (it == material_names.end()) return false;
+			index = it->second;
+			return true;
+		};
+
+		if (tag == "image_width") iss >> cam.image_width;
+		else if (tag == "aspect_ratio") iss >> cam.aspect_ratio;
+		else if (tag == "samples_per_pixel") iss >> cam.samples_per_pixel;
+		else if (tag == "max_depth") iss >> cam.max_depth;
+		else if (tag == "vfov") iss >> cam.vfov;
+		else if (tag == "lookfrom") iss >> cam.lookfrom[0] >> cam.lookfrom[1] >> cam.lookfrom[2];
+		else if (tag == "lookat") iss >> cam.lookat[0] >> cam.lookat[1] >> cam.lookat[2];
+		else if (tag == "vup") iss >> cam.vup[0] >> cam.vup[1] >> cam.vup[2];
+		else if (tag == "defocus_angle") iss >> cam.defocus_angle;
+		else if (tag == "focus_dist") iss >> cam.focus_dist;
+		else if (tag == "sky") iss >> cam.sky;
+		else if (tag == "material") {
+			std::string name, kind;
+			scene_material m = { 0, { 0, 0, 0 }, 0, 1 };
+			iss >> name >> kind;
+			if (kind == "lambertian") {
+				m.type = static_cast<uint32_t>(material_type::lambertian);
+				iss >> m.albedo[0] >> m.albedo[1] >> m.albedo[2];
+			}
+			else if (kind == "metal") {
+				m.type = static_cast<uint32_t>(material_type::metal);
+				iss >> m.albedo[0] >> m.albedo[1] >> m.albedo[2] >> m.fuzzy;
+			}
+			else if (kind == "dielectric") {
+				m.type = static_cast<uint32_t>(material_type::dielectric);
+				m.albedo[0] = m.albedo[1] = m.albedo[2] = 1.f;
+				iss >> m.ir;
+			}
+			else if (kind == "light") {
+				m.type = static_cast<uint32_t>(material_type::diffuse_light);
+				iss >> m.albedo[0] >> m.albedo[1] >> m.albedo[2];
+			}
+			else {
+				return fail("unknown material type '" + kind + "'");
+			}
+			material_names[name] = static_cast<uint32_t>(desc.materials.size());
+			desc.materials.push_back(m);
+		}
+		else if (tag == "sphere") {
+			scene_sphere s;
+			std::string mat;
+			iss >> s.center[0] >> s.center[1] >> s.center[2] >> s.radius >> mat;
+			if (iss && !find_material(mat, s.material))
+				return fail("unknown material '" + mat + "'");
+			desc.spheres.push_back(s);
+		}
+		else if (tag == "quad") {
+			scene_quad q;
+			std::string mat;
+			iss >> q.corner[0] >> q.corner[1] >> q.corner[2] >> q.u[0] >> q.u[1] >> q.u[2]
+				>> q.v[0] >> q.v[1] >> q.v[2] >> mat;
+			if (iss && !find_material(mat, q.material))
+				return fail("unknown material '" + mat + "'");
+			desc.quads.push_back(q);
+		}
+		else if (tag == "mesh") {
+			std::string name, path, mat;
+			iss >> name >> path >> mat;
+			if (!iss) return fail("expected mesh <name> <file.obj> <material>");
+
+			scene_mesh mesh;
+			if (!find_material(mat, mesh.material))
+				return fail("unknown material '" + mat + "'");
+
+			bool relative = path[0] != '/' && path[0] != '\\' && path.find(':') == std::string::npos;
+			std::vector<point3> verts;
+			std::vector<uint32_t> faces;
+			if (!triangle_mesh::read_obj(relative ? directory + path : path, verts, faces))
+				return fail("can not load mesh '" + path + "'");
+
+			mesh.vertex_count = static_cast<uint32_t>(verts.size());
+			mesh.index_count = static_cast<uint32_t>(faces.size());
+			for (const auto& v : verts)
+				desc.vertices.insert(desc.vertices.end(), { v.x(), v.y(), v.z() });
+			desc.indices.insert(desc.indices.end(), faces.begin(), faces.end());
+			mesh_names[name] = static_cast<uint32_t>(desc.meshes.size());
+			desc.meshes.push_back(mesh);
+		}
+		else if (tag == "instance") {
+			std::string name;
+			iss >> name;
+			auto it = mesh_names.find(name);
+			if (it == mesh_names.end())
+				return fail("unknown mesh '" + name + "'");
+
+			scene_instance inst;
+			inst.mesh = it->second;
+			inst.material = instance::keep_material;
+			transform to_world;
+
+			// the options are read ahead as tokens, so scale can look at what follows its factor
+			std::vector<std::string> options;
+			std::string token;
+			while (iss >> token) options.push_back(token);
+			size_t next = 0;
+			auto number = [&](float& value) {
+				if (next >= options.size()) return false;
+				const char* text = options[next].c_str();
+				char* end = nullptr;
+				value = std::strtof(text, &end);
+				if (end == text || *end != '\0') return false;
+				next++;
+				return true;
+			};
+
+			while (next < options.size()) {
+				const std::string& op = options[next++];
+				float x, y, z, w;
+				if (op == "material") {
+					if (next >= options.size())
+						return fail("bad values after 'material'");
+					const std::string& mat = options[next++];
+					if (!find_material(mat, inst.material))
+						return fail("unknown material '" + mat + "'");
+				}
+				else if (op == "translate") {
+					if (!number(x) || !number(y) || !number(z))
+						return fail("bad values after 'translate'");
+					to_world = transform::translate(vec3(x, y, z)) * to_world;
+				}
+				else if (op == "rotate") {
+					if (!number(x) || !number(y) || !number(z) || !number(w))
+						return fail("bad values after 'rotate'");
+					to_world = transform::rotate(vec3(x, y, z), w) * to_world;
+				}
+				else if (op == "scale") {
+					// one factor, or one per axis
+					if (!number(x))
+						return fail("bad values after 'scale'");
+					size_t mark = next;
+					if (number(y) && number(z)) {
+						to_world = transform::scale(vec3(x, y, z)) * to_world;
+					}
+					else {
+						next = mark;
+						to_world = transform::scale(x) * to_world;
+					}
+				}
+				else {
+					return fail("unknown instance option '" + op + "'");
+				}
+			}
+			std::memcpy(inst.m, to_world.m, sizeof(inst.m));
+			desc.instances.push_back(inst);
+			continue;
+		}
+		else {
+			return fail("unknown keyword '" + tag + "'");
+		}
+
+		if (!iss) return fail("bad values for '" + tag + "'");
+	}
+
+	return true;
+}
+
+// The binary form of desc in memory, as written to a ".rtb" file
+inline void encode_scene(const scene_description& desc, std::vector<unsigned char>& bytes) {
+	scene_file_header header;
+	header.material_count = static_cast<uint32_t>(desc.materials.size());
+	header.sphere_count = static_cast<uint32_t>(desc.spheres.size());
+	header.quad_count = static_cast<uint32_t>(desc.quads.size());
+	header.mesh_count = static_cast<uint32_t>(desc.meshes.size());
+	header.vertex_count = static_cast<uint32_t>(desc.vertices.size() / 3);
+	header.index_count = static_cast<uint32_t>(desc.indices.size());
+	header.instance_count = static_cast<uint32_t>(desc.instances.size());
+	header.camera = desc.camera;
+
+	bytes.clear();
+	auto write = [&](const void* p, size_t size) {
+		const unsigned char* b = static_cast<const unsigned char*>(p);
+		bytes.insert(bytes.end(), b, b + size);
+	};
+	write(&header, sizeof(header));
+	write(desc.materials.data(), desc.materials.size() * sizeof(scene_material));
+	write(desc.spheres.data(), desc.spheres.size() * sizeof(scene_sphere));
+	write(desc.quads.data(), desc.quads.size() * sizeof(scene_quad));
+	write(desc.meshes.data(), desc.meshes.size() * sizeof(scene_mesh));
+	write(desc.vertices.data(), desc.vertices.size() * sizeof(float));
+	write(desc.indices.data(), desc.indices.size() * sizeof(uint32_t));
+	write(desc.instances.data(), desc.instances.size() * sizeof(scene_instance));
+}
+
+inline bool write_scene_binary(const std::string& filename, const scene_description& desc) {
+	std::ofstream file(filename, std::ios::binary);
+	if (!file.is_open()) return false;
+
+	std::vector<unsigned char> bytes;
+	encode_scene(desc, bytes);
+	file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+	return file.good();
+}
+
+// Build world, lights, materials and camera settings straight from the flat arrays. All
+// spheres go into one sphere_soup with its own BVH, every mesh into one triangle_mesh, and
+// a bvh_node over the spheres, quads and mesh instances forms the top level. Emissive
+// spheres and quads also go into lights, for light sampling.
+inline bool build_scene(const scene_file_header& header, const scene_material* scene_materials,
+	const scene_sphere* spheres, const scene_quad* quads, const scene_mesh* meshes, const float* vertices,
+	const uint32_t* indices, const scene_instance* instances, hittable_list& world, hittable_list& lights,
+	material_list& materials, camera& cam, bvh_layout layout = bvh_layout::binary) {
+	uint32_t first_material = static_cast<uint32_t>(materials.size());
+	for (uint32_t k = 0; k < header.material_count; k++) {
+		const scene_material& sm = scene_materials[k];
+		if (sm.type > static_cast<uint32_t>(material_type::diffuse_light)) {
+			std::cerr << "Scene material " << k << " has an unknown type" << std::endl;
+			return false;
+		}
+		material m;
+		m.type = static_cast<material_type>(sm.type);
+		m.albedo = color(sm.albedo[0], sm.albedo[1], sm.albedo[2]);
+		m.fuzzy = sm.fuzzy;
+		m.ir = sm.ir;
+		if (m.type == material_type::diffuse_light) {
+			m.emission = m.albedo;
+			m.albedo = color(0, 0, 0);
+		}
+		materials.add(m);
+	}
+	auto is_light = [&](uint32_t k) { return scene_materials[k].type == static_cast<uint32_t>(material_type::diffuse_light); };
+
+	// the shapes share one arena, freed with the last of them
+	scene_arena arena;
+	std::vector<shared_ptr<hittable>> objects;
+
+	if (header.sphere_count > 0) {
+		auto soup = arena.make<sphere_soup>();
+		soup->reserve(header.sphere_count);
+		for (uint32_t k = 0; k < header.sphere_count; k++) {
+			const scene_sphere& s = spheres[k];
+			if (s.material >= header.material_count) {
+				std::cerr << "Scene sphere " << k << " has no material" << std::endl;
+				return false;
+			}
+			soup->add(point3(s.center[0], s.center[1], s.center[2]), s.radius, first_material + s.material);
+			if (is_light(s.material))
+				lights.add(arena.make<sphere>(point3(s.center[0], s.center[1], s.center[2]), s.radius, first_material + s.material));
+		}
+		soup->build();
+		objects.push_back(soup);
+	}
+
+	for (uint32_t k = 0; k < header.quad_count; k++) {
+		const scene_quad& q = quads[k];
+		if (q.material >= header.material_count) {
+			std::cerr << "Scene quad " << k << " has no material" << std::endl;
+			return false;
+		}
+		auto shape = arena.make<quad>(point3(q.corner[0], q.corner[1], q.corner[2]), vec3(q.u[0], q.u[1], q.u[2]),
+			vec3(q.v[0], q.v[1], q.v[2]), first_material + q.material);
+		objects.push_back(shape);
+		if (is_light(q.material))
+			lights.add(shape);
+	}
+
+	std::vector<shared_ptr<triangle_mesh>> shapes;
+	size_t vertex_offset = 0, index_offset = 0;
+	for (uint32_t k = 0; k < header.mesh_count; k++) {
+		const scene_mesh& mesh = meshes[k];
+		if (mesh.material >= header.material_count || mesh.index_count % 3 != 0
+			|| vertex_offset + mesh.vertex_count > header.vertex_count || index_offset + mesh.index_count > header.index_count) {
+			std::cerr << "Scene mesh " << k << " is malformed" << std::endl;
+			return false;
+		}
+
+		std::vector<point3> verts(mesh.vertex_count);
+		for (uint32_t v = 0; v < mesh.vertex_count; v++) {
+			const float* p = vertices + 3 * (vertex_offset + v);
+			verts[v] = point3(p[0], p[1], p[2]);
+		}
+		std::vector<uint32_t> tris(indices + index_offset, indices + index_offset + mesh.index_count);
+		for (uint32_t index : tris) {
+			if (index >= mesh.vertex_count) {
+				std::cerr << "Scene mesh " << k << " indexes past its vertices" << std::endl;
+				return false;
+			}
+		}
+
+		shapes.push_back(arena.make<triangle_mesh>(std::move(verts), std::move(tris), first_material + mesh.material));
+		vertex_offset += mesh.vertex_count;
+		index_offset += mesh.index_count;
+	}
+
+	for (uint32_t k = 0; k < header.instance_count; k++) {
+		const scene_instance& inst = instances[k];
+		if (inst.mesh >= header.mesh_count
+			|| (inst.material != instance::keep_material && inst.material >= header.material_count)) {
+			std::cerr << "Scene instance " << k << " is malformed" << std::endl;
+			return false;
+		}
+		transform to_world;
+		std::memcpy(to_world.m, inst.m, sizeof(to_world.m));
+		uint32_t mat = inst.material == instance::keep_material ? instance::keep_material : first_material + inst.material;
+		// an instance holds a handle to its mesh; built in the arena it would keep the arena alive itself
+		objects.push_back(make_shared<instance>(shapes[inst.mesh], to_world, mat));
+	}
+
+	if (objects.size() == 1)
+		world.add(objects[0]);
+	else if (objects.size() > 1) {
+		hittable_list top;
+		top.objects = std::move(objects);
+		world.add(make_bvh(top, layout));
+	}
+
+	header.camera.apply(cam);
+	return true;
+}
+
+inline bool build_scene(const scene_description& desc, hittable_list& world, hittable_list& lights,
+	material_list& materials, camera& cam, bvh_layout layout = bvh_layout::binary) {
+	scene_file_header header;
+	header.material_count = static_cast<uint32_t>(desc.materials.size());
+	header.sphere_count = static_cast<uint32_t>(desc.spheres.size());
+	header.quad_count = static_cast<uint32_t>(desc.quads.size());
+	header.mesh_count = static_cast<uint32_t>(desc.meshes.size());
+	header.vertex_count = static_cast<uint32_t>(desc.vertices.size() / 3);
+	header.index_count = static_cast<uint32_t>(desc.indices.size());
+	header.instance_count = static_cast<uint32_t>(desc.instances.size());
+	header.camera = desc.camera;
+
+	return build_scene(header, desc.materials.data(), desc.spheres.data(), desc.quads.data(), desc.meshes.data(),
+		desc.vertices.data(), desc.indices.data(), desc.instances.data(), world, lights, materials, cam, layout);
+}
+
+// Build straight out of a binary scene in memory, the arrays are never copied as a whole;
+// name is only for the messages
+inline bool build_scene_binary(const unsigned char* data, size_t size, const std::string& name,
+	hittable_list& world, hittable_list& lights, material_list& materials, camera& cam,
+	bvh_layout layout = bvh_layout::binary) {
+	scene_file_header header;
+	if (size < sizeof(header)) {
+		std::cerr << name << " is not a scene file" << std::endl;
+		return false;
+	}
+	std::memcpy(&header, data, sizeof(header));
+
+	scene_file_header expected;
+	size_t expected_size = sizeof(header) + static_cast<size_t>(header.material_count) * sizeof(scene_material)
+		+ static_cast<size_t>(header.sphere_count) * sizeof(scene_sphere)
+		+ static_cast<size_t>(header.quad_count) * sizeof(scene_quad)
+		+ static_cast<size_t>(header.mesh_count) * sizeof(scene_mesh)
+		+ static_cast<size_t>(header.vertex_count) * 3 * sizeof(float)
+		+ static_cast<size_t>(header.index_count) * sizeof(uint32_t)
+		+ static_cast<size_t>(header.instance_count) * sizeof(scene_instance);
+	if (std::memcmp(header.magic, expected.magic, 4) != 0 || header.version != expected.version || size != expected_size) {
+		std::cerr << name << " is not a scene file of this version" << std::endl;
+		return false;
+	}
+
+	const unsigned char* p = data + sizeof(header);
+	auto take = [&p](size_t bytes) { const unsigned char* at = p; p += bytes; return at; };
+	auto scene_materials = reinterpret_cast<const scene_material*>(take(header.material_count * sizeof(scene_material)));
+	auto spheres = reinterpret_cast<const scene_sphere*>(take(header.sphere_count * sizeof(scene_sphere)));
+	auto quads = reinterpret_cast<const scene_quad*>(take(header.quad_count * sizeof(scene_quad)));
+	auto meshes = reinterpret_cast<const scene_mesh*>(take(header.mesh_count * sizeof(scene_mesh)));
+	auto vertices = reinterpret_cast<const float*>(take(static_cast<size_t>(header.vertex_count) * 3 * sizeof(float)));
+	auto indices = reinterpret_cast<const uint32_t*>(take(header.index_count * sizeof(uint32_t)));
+	auto instances = reinterpret_cast<const scene_instance*>(take(header.instance_count * sizeof(scene_instance)));
+
+	return build_scene(header, scene_materials, spheres, quads, meshes, vertices, indices, instances,
+		world, lights, materials, cam, layout);
+}
+
+// Build straight out of a mapped binary scene
+inline bool load_scene_binary(const std::string& filename, hittable_list& world, hittable_list& lights,
+	material_list& materials, camera& cam, bvh_layout layout = bvh_layout::binary) {
+	mapped_file file;
+	if (!file.open(filename)) {
+		std::cerr << "Can not open " << filename << std::endl;
+		return false;
+	}
+	return build_scene_binary(file.data(), file.size(), filename, world, lights, materials, cam, layout);
+}
+
+// Load a ".rtb" binary or a text scene file; layout is that of the top level BVH
+inline bool load_scene(const std::string& filename, hittable_list& world, hittable_list& lights,
+	material_list& materials, camera& cam, bvh_layout layout = bvh_layout::binary) {
+	if (filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".rtb") == 0)
+		return load_scene_binary(filename, world, lights, materials, cam, layout);
+
+	scene_description desc;
+	return read_scene_text(filename, desc) && build_scene(desc, world, lights, materials, cam, layout);
+}
+
+// The binary form of a ".rtb" or text scene file, to hand a scene to other processes
+inline bool read_scene_bytes(const std::string& filename, std::vector<unsigned char>& bytes) {
+	if (filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".rtb") == 0) {
+		mapped_file file;
+		if (!file.open(filename)) {
+			std::cerr << "Can not open " << filename << std::endl;
+			return false;
+		}
+		bytes.assign(file.data(), file.data() + file.size());
+		return true;
+	}
+
+	scene_description desc;
+	if (!read_scene_text(filename, desc)) return false;
+	encode_scene(desc, bytes);
+	return true;
+}
+
+#endif // !SCENE_H
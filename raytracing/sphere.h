@@ -6,11 +6,26 @@
 
 class sphere : public hittable {
 public:
-	sphere(point3 _center, float _radius, shared_ptr<material> _material): 
-		center(_center), radius(_radius), m(_material) {}
+	sphere(point3 _center, float _radius, uint32_t _material): 
+		center(_center), radius(_radius), mat(_material) {
+		// radius may be negative for hollow spheres
+		auto rvec = vec3(fabs(radius), fabs(radius), fabs(radius));
+		bbox = aabb(center - rvec, center + rvec);
+	}
+
+	// Moving sphere: the center goes from _center at time 0 to _center2 at time 1, and the
+	// box covers the whole sweep so a static BVH stays valid for every ray time.
+	sphere(point3 _center, point3 _center2, float _radius, uint32_t _material) :
+		center(_center), radius(_radius), mat(_material), is_moving(true) {
+		motion = _center2 - _center;
+		auto rvec = vec3(fabs(radius), fabs(radius), fabs(radius));
+		bbox = aabb(aabb(_center - rvec, _center + rvec), aabb(_center2 - rvec, _center2 + rvec));
+	}
 
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override{
-		vec3 oc = r.origin() - center;
+		RT_STATS_ADD(intersection_tests, 1);
+		point3 current = center_at(r.time());
+		vec3 oc = r.origin() - current;
 		auto a = dot(r.direction(), r.direction());
 		//auto b = 2.f * dot(r.direction(), oc);
 		auto half_b = dot(r.direction(), oc);
@@ -28,18 +43,98 @@ public:
 				return false;
 		}
 
-		rec.t = root;
-		rec.p = r.at(rec.t);
-		vec3 outward_normal = (rec.p - center) / radius;
-		rec.set_face_normal(r, outward_normal);
-		rec.m = m;
+		set_record(r, root, current, rec);
 
 		return true;
 	}
+
+	unsigned int hit_packet(ray_packet& packet, unsigned int mask, hit_record* rec) const override {
+		RT_STATS_ADD(intersection_tests, mask_lanes(mask));
+		float root[ray_packet::max_size];
+
+		// one sphere against every lane, same arithmetic as hit()
+		for (int l = 0; l < ray_packet::max_size; l++) {
+			point3 current = center_at(packet.time[l]);
+			float ocx = packet.ox[l] - current.x(), ocy = packet.oy[l] - current.y(), ocz = packet.oz[l] - current.z();
+			float a = packet.dx[l] * packet.dx[l] + packet.dy[l] * packet.dy[l] + packet.dz[l] * packet.dz[l];
+			float half_b = packet.dx[l] * ocx + packet.dy[l] * ocy + packet.dz[l] * ocz;
+			float c = (ocx * ocx + ocy * ocy + ocz * ocz) - radius * radius;
+			float discriminant = half_b * half_b - a * c;
+			float sqrtd = sqrt(discriminant < 0 ? 0.f : discriminant);
+
+			float near_t = (-half_b - sqrtd) / a;
+			float far_t = (-half_b + sqrtd) / a;
+			bool near_ok = packet.tmin < near_t && near_t < packet.tmax[l];
+			bool far_ok = packet.tmin < far_t && far_t < packet.tmax[l];
+			root[l] = discriminant < 0 ? -1.f : (near_ok ? near_t : (far_ok ? far_t : -1.f));
+		}
+
+		unsigned int hits = 0;
+		for (int l = 0; l < packet.size; l++) {
+			if (!(mask >> l & 1u) || root[l] < 0) continue;
+			set_record(packet.get(l), root[l], center_at(packet.time[l]), rec[l]);
+			packet.tmax[l] = root[l];
+			hits |= 1u << l;
+		}
+		return hits;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	// as a light: directions are drawn uniformly from the cone the sphere subtends where
+	// it is at time
+	float pdf_value(const point3& origin, const vec3& direction, float time) const override {
+		hit_record rec;
+		if (!hit(ray(origin, direction, time), interval(0.001f, infinity), rec))
+			return 0.f;
+
+		auto distance_squared = (center_at(time) - origin).length_squared();
+		if (distance_squared <= radius * radius)
+			return 0.f;
+		auto cos_theta_max = sqrt(1.f - radius * radius / distance_squared);
+		auto solid_angle = 2.f * pi * (1.f - cos_theta_max);
+		return 1.f / solid_angle;
+	}
+
+	vec3 random(const point3& origin, float time) const override {
+		vec3 direction = center_at(time) - origin;
+		auto distance_squared = direction.length_squared();
+		if (distance_squared <= radius * radius)
+			return random_unit_vector();
+
+		// sample the cone around +z, then rotate it onto the direction to the center
+		float r1, r2;
+		random_float2(r1, r2);
+		auto cos_theta_max = sqrt(1.f - radius * radius / distance_squared);
+		auto z = 1.f + r2 * (cos_theta_max - 1.f);
+		auto phi = 2.f * pi * r1;
+		auto sin_theta = sqrt(1.f - z * z);
+
+		vec3 w = unit_vector(direction);
+		vec3 a = fabs(w.x()) > 0.9f ? vec3(0, 1, 0) : vec3(1, 0, 0);
+		vec3 v = unit_vector(cross(w, a));
+		vec3 u = cross(w, v);
+		return cos(phi) * sin_theta * u + sin(phi) * sin_theta * v + z * w;
+	}
 	
 private:
 	point3 center;
 	float radius;
-	shared_ptr<material> m;
+	uint32_t mat;
+	bool is_moving = false;
+	vec3 motion; // center displacement from time 0 to time 1
+	aabb bbox;
+
+	point3 center_at(float time) const {
+		return is_moving ? center + time * motion : center;
+	}
+
+	void set_record(const ray& r, float root, const point3& current, hit_record& rec) const {
+		rec.t = root;
+		rec.p = r.at(rec.t);
+		vec3 outward_normal = (rec.p - current) / radius;
+		rec.set_face_normal(r, outward_normal);
+		rec.mat = mat;
+	}
 };
 #endif // !SPHERE_H
@@ -0,0 +1,354 @@
+#ifndef SPHERE_SOUP_H
+#define SPHERE_SOUP_H
+
+#include "bvh.h"
+#include "hittable.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Many spheres in one hittable, stored as structure of arrays so one ray can be
+// tested against a whole batch of them with SIMD: 16 at a time with AVX-512,
+// 8 with AVX2, one by one otherwise. Gives the same hits as a hittable_list of sphere.
+// After build() a flat BVH whose leaves are single batches narrows the search; the soup
+// is complete from then on.
+class sphere_soup : public hittable {
+public:
+#if defined(__AVX512F__)
+	static const int lanes = 16;
+#elif defined(__AVX2__)
+	static const int lanes = 8;
+#else
+	static const int lanes = 1;
+#endif
+
+	sphere_soup() {}
+
+	void reserve(size_t n) {
+		size_t padded = (n + lanes - 1) / lanes * lanes;
+		cx.reserve(padded); cy.reserve(padded); cz.reserve(padded);
+		radius.reserve(padded);
+		mat.reserve(n);
+	}
+
+	// false once built, the spheres have moved into leaf order and there is no free slot
+	bool add(point3 center, float r, uint32_t material) {
+		if (!nodes.empty()) {
+			std::cerr << "sphere_soup: spheres can not be added after build" << std::endl;
+			return false;
+		}
+
+		// overwrite the padding of the last batch, or open a new one
+		if (count % lanes == 0) {
+			cx.resize(count + lanes, 0.f); cy.resize(count + lanes, 0.f); cz.resize(count + lanes, 0.f);
+			radius.resize(count + lanes, 0.f);
+		}
+		cx[count] = center.x(); cy[count] = center.y(); cz[count] = center.z();
+		radius[count] = r;
+		mat.push_back(material);
+		count++;
+		sphere_count++;
+
+		auto rvec = vec3(fabs(r), fabs(r), fabs(r));
+		bbox = aabb(bbox, aabb(center - rvec, center + rvec));
+		return true;
+	}
+
+	// spheres added, padding not included
+	size_t size() const { return sphere_count; }
+
+	// Build the BVH once every sphere is added; the spheres move into leaf order, every
+	// leaf starting on a batch boundary and padded to whole batches. Building again does
+	// nothing.
+	void build() {
+		if (!nodes.empty() || count == 0) return;
+
+		std::vector<bvh_primitive> prims(count);
+		for (size_t k = 0; k < count; k++) {
+			auto rvec = vec3(fabs(radius[k]), fabs(radius[k]), fabs(radius[k]));
+			prims[k].box = aabb(center(k) - rvec, center(k) + rvec);
+			prims[k].centroid = center(k);
+			prims[k].index = static_cast<int>(k);
+		}
+
+		sphere_soup sorted;
+		sorted.reserve(2 * count);
+		nodes.reserve(2 * count / lanes + 1);
+		build_node(prims, 0, count, 0, sorted);
+
+		cx.swap(sorted.cx); cy.swap(sorted.cy); cz.swap(sorted.cz);
+		radius.swap(sorted.radius);
+		mat.swap(sorted.mat);
+		count = sorted.count;
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		float closest = ray_t.max;
+		size_t best = no_hit;
+
+		if (nodes.empty()) {
+			RT_STATS_ADD(intersection_tests, count);
+			best = find_closest(r, ray_t.min, closest, 0, count);
+		}
+		else {
+			vec3 dir = r.direction();
+			int stack[max_depth + 2];
+			int top = 0;
+			stack[top++] = 0;
+
+			while (top > 0) {
+				const soup_node& node = nodes[stack[--top]];
+				RT_STATS_ADD(bvh_node_visits, 1);
+				if (!node.box.hit(r, interval(ray_t.min, closest)))
+					continue;
+
+				if (node.count > 0) {
+					RT_STATS_ADD(intersection_tests, node.count);
+					size_t k = find_closest(r, ray_t.min, closest, node.start, node.start + node.count);
+					if (k != no_hit) best = k;
+				}
+				else {
+					// visit the child on the near side of the split first
+					int near_child = node.start, far_child = node.right;
+					if (dir[node.axis] < 0) std::swap(near_child, far_child);
+					stack[top++] = far_child;
+					stack[top++] = near_child;
+				}
+			}
+		}
+
+		if (best == no_hit)
+			return false;
+
+		rec.t = closest;
+		rec.p = r.at(rec.t);
+		vec3 outward_normal = (rec.p - center(best)) / radius[best];
+		rec.set_face_normal(r, outward_normal);
+		rec.mat = mat[best];
+
+		return true;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+private:
+	// Same layout as the mesh BVH: interior nodes keep the left child right after them
+	struct soup_node {
+		aabb box;
+		int start; // first slot of a leaf, left child of an interior node
+		int right; // right child of an interior node
+		uint32_t count; // spheres in a leaf, 0 for interior nodes
+		int axis; // split axis of an interior node
+	};
+
+	static const int max_depth = 126; // bounds the traversal stack
+	static const size_t no_hit = ~static_cast<size_t>(0);
+
+	point3 center(size_t k) const { return point3(cx[k], cy[k], cz[k]); }
+
+	// SoA storage, padded up to a whole number of batches
+	std::vector<float> cx, cy, cz;
+	std::vector<float> radius;
+	std::vector<uint32_t> mat;
+	size_t count = 0; // slots in use: the spheres, and after build the padding between leaves
+	size_t sphere_count = 0;
+	std::vector<soup_node> nodes;
+	aabb bbox;
+
+	int build_node(std::vector<bvh_primitive>& prims, size_t start, size_t end, int depth, sphere_soup& sorted) {
+		int index = static_cast<int>(nodes.size());
+		nodes.push_back(soup_node());
+
+		aabb box;
+		for (size_t k = start; k < end; k++)
+			box = aabb(box, prims[k].box);
+		nodes[index].box = box;
+
+		// a leaf is one batch, padded so the next leaf starts on a batch boundary too
+		const size_t leaf_size = lanes < 4 ? 4 : lanes;
+		if (end - start <= leaf_size) {
+			nodes[index].start = static_cast<int>(sorted.cx.size());
+			nodes[index].count = static_cast<uint32_t>(end - start);
+			for (size_t k = start; k < end; k++) {
+				size_t from = static_cast<size_t>(prims[k].index);
+				sorted.add(center(from), radius[from], mat[from]);
+			}
+			sorted.count = sorted.cx.size();
+			sorted.mat.resize(sorted.count, 0);
+			return index;
+		}
+
+		aabb centroids;
+		for (size_t k = start; k < end; k++)
+			centroids = aabb(centroids, aabb(prims[k].centroid, prims[k].centroid));
+		int axis = centroids.longest_axis();
+
+		// past half the depth budget fall back to median splits, which halve the count every level
+		size_t mid;
+		if (depth < max_depth / 2) {
+			mid = sah_partition(prims, start, end);
+		}
+		else {
+			mid = start + (end - start) / 2;
+			std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+				[axis](const bvh_primitive& a, const bvh_primitive& b) { return a.centroid[axis] < b.centroid[axis]; });
+		}
+
+		int left = build_node(prims, start, mid, depth + 1, sorted);
+		int right = build_node(prims, mid, end, depth + 1, sorted);
+		nodes[index].start = left;
+		nodes[index].right = right;
+		nodes[index].count = 0;
+		nodes[index].axis = axis;
+		return index;
+	}
+
+	// index of the closest sphere of [begin, end) hit in (tmin, closest), updating closest;
+	// no_hit if none. begin must be a multiple of lanes.
+	size_t find_closest(const ray& r, float tmin, float& closest, size_t begin, size_t end) const {
+		point3 o = r.origin();
+		vec3 d = r.direction();
+		float a = dot(d, d);
+		size_t best = no_hit;
+
+#if defined(__AVX512F__)
+		const __m512 ox = _mm512_set1_ps(o.x()), oy = _mm512_set1_ps(o.y()), oz = _mm512_set1_ps(o.z());
+		const __m512 dx = _mm512_set1_ps(d.x()), dy = _mm512_set1_ps(d.y()), dz = _mm512_set1_ps(d.z());
+		const __m512 va = _mm512_set1_ps(a);
+		const __m512 vmin = _mm512_set1_ps(tmin);
+		const __m512i lane_index = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		__m512 best_t = _mm512_set1_ps(closest);
+		__m512i best_i = _mm512_set1_epi32(-1);
+
+		for (size_t k = begin; k < end; k += lanes) {
+			__m512 ocx = _mm512_sub_ps(ox, _mm512_loadu_ps(&cx[k]));
+			__m512 ocy = _mm512_sub_ps(oy, _mm512_loadu_ps(&cy[k]));
+			__m512 ocz = _mm512_sub_ps(oz, _mm512_loadu_ps(&cz[k]));
+			__m512 rr = _mm512_loadu_ps(&radius[k]);
+
+			__m512 half_b = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, ocx), _mm512_mul_ps(dy, ocy)), _mm512_mul_ps(dz, ocz));
+			__m512 c = _mm512_sub_ps(
+				_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, ocx), _mm512_mul_ps(ocy, ocy)), _mm512_mul_ps(ocz, ocz)),
+				_mm512_mul_ps(rr, rr));
+			__m512 disc = _mm512_sub_ps(_mm512_mul_ps(half_b, half_b), _mm512_mul_ps(va, c));
+
+			// lanes past the last sphere are padding
+			__mmask16 valid = _mm512_cmp_ps_mask(disc, _mm512_setzero_ps(), _CMP_GE_OQ);
+			if (end - k < static_cast<size_t>(lanes))
+				valid &= static_cast<__mmask16>((1u << (end - k)) - 1);
+			if (!valid) continue;
+
+			__m512 sqrtd = _mm512_sqrt_ps(_mm512_max_ps(disc, _mm512_setzero_ps()));
+			__m512 near_t = _mm512_div_ps(_mm512_sub_ps(_mm512_sub_ps(_mm512_setzero_ps(), half_b), sqrtd), va);
+			__m512 far_t = _mm512_div_ps(_mm512_add_ps(_mm512_sub_ps(_mm512_setzero_ps(), half_b), sqrtd), va);
+
+			// same root choice as sphere::hit: the near root if it lies inside the interval, else the far one
+			__mmask16 near_ok = _mm512_cmp_ps_mask(near_t, vmin, _CMP_GT_OQ) & _mm512_cmp_ps_mask(near_t, best_t, _CMP_LT_OQ);
+			__mmask16 far_ok = _mm512_cmp_ps_mask(far_t, vmin, _CMP_GT_OQ) & _mm512_cmp_ps_mask(far_t, best_t, _CMP_LT_OQ);
+			__m512 t = _mm512_mask_blend_ps(near_ok, far_t, near_t);
+			__mmask16 take = valid & (near_ok | far_ok);
+
+			best_t = _mm512_mask_blend_ps(take, best_t, t);
+			best_i = _mm512_mask_blend_epi32(take, best_i, _mm512_add_epi32(lane_index, _mm512_set1_epi32(static_cast<int>(k))));
+		}
+
+		alignas(64) float t_lanes[16];
+		alignas(64) int i_lanes[16];
+		_mm512_store_ps(t_lanes, best_t);
+		_mm512_store_si512(reinterpret_cast<__m512i*>(i_lanes), best_i);
+		reduce_lanes(t_lanes, i_lanes, closest, best);
+
+#elif defined(__AVX2__)
+		const __m256 ox = _mm256_set1_ps(o.x()), oy = _mm256_set1_ps(o.y()), oz = _mm256_set1_ps(o.z());
+		const __m256 dx = _mm256_set1_ps(d.x()), dy = _mm256_set1_ps(d.y()), dz = _mm256_set1_ps(d.z());
+		const __m256 va = _mm256_set1_ps(a);
+		const __m256 vmin = _mm256_set1_ps(tmin);
+		const __m256i lane_index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		__m256 best_t = _mm256_set1_ps(closest);
+		__m256i best_i = _mm256_set1_epi32(-1);
+
+		for (size_t k = begin; k < end; k += lanes) {
+			__m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&cx[k]));
+			__m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&cy[k]));
+			__m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&cz[k]));
+			__m256 rr = _mm256_loadu_ps(&radius[k]);
+
+			__m256 half_b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, ocx), _mm256_mul_ps(dy, ocy)), _mm256_mul_ps(dz, ocz));
+			__m256 c = _mm256_sub_ps(
+				_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz)),
+				_mm256_mul_ps(rr, rr));
+			__m256 disc = _mm256_sub_ps(_mm256_mul_ps(half_b, half_b), _mm256_mul_ps(va, c));
+
+			// lanes past the last sphere are padding
+			__m256 valid = _mm256_cmp_ps(disc, _mm256_setzero_ps(), _CMP_GE_OQ);
+			if (end - k < static_cast<size_t>(lanes)) {
+				__m256i limit = _mm256_set1_epi32(static_cast<int>(end - k));
+				valid = _mm256_and_ps(valid, _mm256_castsi256_ps(_mm256_cmpgt_epi32(limit, lane_index)));
+			}
+			if (_mm256_movemask_ps(valid) == 0) continue;
+
+			__m256 sqrtd = _mm256_sqrt_ps(_mm256_max_ps(disc, _mm256_setzero_ps()));
+			__m256 near_t = _mm256_div_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), half_b), sqrtd), va);
+			__m256 far_t = _mm256_div_ps(_mm256_add_ps(_mm256_sub_ps(_mm256_setzero_ps(), half_b), sqrtd), va);
+
+			// same root choice as sphere::hit: the near root if it lies inside the interval, else the far one
+			__m256 near_ok = _mm256_and_ps(_mm256_cmp_ps(near_t, vmin, _CMP_GT_OQ), _mm256_cmp_ps(near_t, best_t, _CMP_LT_OQ));
+			__m256 far_ok = _mm256_and_ps(_mm256_cmp_ps(far_t, vmin, _CMP_GT_OQ), _mm256_cmp_ps(far_t, best_t, _CMP_LT_OQ));
+			__m256 t = _mm256_blendv_ps(far_t, near_t, near_ok);
+			__m256 take = _mm256_and_ps(valid, _mm256_or_ps(near_ok, far_ok));
+
+			best_t = _mm256_blendv_ps(best_t, t, take);
+			best_i = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(best_i),
+				_mm256_castsi256_ps(_mm256_add_epi32(lane_index, _mm256_set1_epi32(static_cast<int>(k)))), take));
+		}
+
+		alignas(32) float t_lanes[8];
+		alignas(32) int i_lanes[8];
+		_mm256_store_ps(t_lanes, best_t);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(i_lanes), best_i);
+		reduce_lanes(t_lanes, i_lanes, closest, best);
+
+#else
+		for (size_t k = begin; k < end; k++) {
+			vec3 oc = o - center(k);
+			auto half_b = dot(d, oc);
+			auto c = dot(oc, oc) - radius[k] * radius[k];
+			auto discriminant = half_b * half_b - a * c;
+			if (discriminant < 0) continue;
+			auto sqrtd = sqrt(discriminant);
+
+			interval ray_t(tmin, closest);
+			auto root = (-half_b - sqrtd) / a;
+			if (!ray_t.surrounds(root)) {
+				root = (-half_b + sqrtd) / a;
+				if (!ray_t.surrounds(root))
+					continue;
+			}
+			closest = root;
+			best = k;
+		}
+#endif
+		return best;
+	}
+
+	// pick the closest of the per-lane winners, the lowest index on ties like a sequential scan
+	void reduce_lanes(const float* t_lanes, const int* i_lanes, float& closest, size_t& best) const {
+		for (int l = 0; l < lanes; l++) {
+			if (i_lanes[l] < 0) continue;
+			size_t index = static_cast<size_t>(i_lanes[l]);
+			if (t_lanes[l] < closest || (t_lanes[l] == closest && index < best)) {
+				closest = t_lanes[l];
+				best = index;
+			}
+		}
+	}
+};
+
+#endif // !SPHERE_SOUP_H
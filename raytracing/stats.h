@@ -0,0 +1,108 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Render counters. Define RT_STATS to collect them: every thread counts into its own
+// thread_local render_stats, the camera folds those into one slot per worker after
+// each tile and merges the slots at the end. Without RT_STATS the RT_STATS_* macros
+// expand to nothing, so the hot paths carry no extra work.
+struct render_stats {
+	static const int depth_buckets = 32; // the last bucket also collects every deeper bounce
+
+	uint64_t rays[depth_buckets] = {}; // rays traced, by bounce depth
+	uint64_t shadow_rays = 0; // light sampling rays, not part of rays
+	uint64_t intersection_tests = 0; // ray-primitive tests
+	uint64_t bvh_node_visits = 0; // bvh_node and mesh BVH nodes entered
+	uint64_t scatters[3] = {}; // scatter calls, indexed by material_type
+	double seconds = 0; // time spent rendering tiles
+
+	uint64_t total_rays() const {
+		uint64_t total = 0;
+		for (uint64_t n : rays) total += n;
+		return total;
+	}
+
+	void merge(const render_stats& other) {
+		for (int d = 0; d < depth_buckets; d++) rays[d] += other.rays[d];
+		shadow_rays += other.shadow_rays;
+		intersection_tests += other.intersection_tests;
+		bvh_node_visits += other.bvh_node_visits;
+		for (int m = 0; m < 3; m++) scatters[m] += other.scatters[m];
+		seconds += other.seconds;
+	}
+};
+
+inline render_stats& thread_stats() {
+	thread_local render_stats stats;
+	return stats;
+}
+
+inline int mask_lanes(unsigned int mask) {
+	int n = 0;
+	for (; mask; mask &= mask - 1) n++;
+	return n;
+}
+
+#if defined(RT_STATS)
+#define RT_STATS_ADD(counter, n) (thread_stats().counter += (n))
+#define RT_STATS_RAYS(depth, n) (thread_stats().rays[(depth) < render_stats::depth_buckets ? (depth) : render_stats::depth_buckets - 1] += (n))
+#else
+#define RT_STATS_ADD(counter, n) ((void)0)
+#define RT_STATS_RAYS(depth, n) ((void)0)
+#endif
+
+// image file name without its extension, the base of the files written next to it
+inline std::string file_stem(const std::string& image_file) {
+	size_t dot = image_file.find_last_of('.');
+	size_t slash = image_file.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		dot = image_file.size();
+	return image_file.substr(0, dot);
+}
+
+// image.ppm -> image.stats.json
+inline std::string stats_filename(const std::string& image_file) {
+	return file_stem(image_file) + ".stats.json";
+}
+
+// the merged totals plus one entry per worker thread, as JSON for tracking between builds
+inline bool write_stats(const std::string& filename, const std::vector<render_stats>& workers, double seconds) {
+	std::ofstream file(filename);
+	if (!file.is_open()) return false;
+
+	render_stats total;
+	for (const auto& w : workers) total.merge(w);
+	uint64_t rays = total.total_rays();
+
+	file << "{\n";
+	file << "  \"seconds\": " << seconds << ",\n";
+	file << "  \"threads\": " << workers.size() << ",\n";
+	file << "  \"rays\": " << rays << ",\n";
+	file << "  \"rays_per_second\": " << (seconds > 0 ? rays / seconds : 0) << ",\n";
+	file << "  \"rays_per_depth\": [";
+	for (int d = 0; d < render_stats::depth_buckets; d++)
+		file << (d ? ", " : "") << total.rays[d];
+	file << "],\n";
+	file << "  \"shadow_rays\": " << total.shadow_rays << ",\n";
+	file << "  \"intersection_tests\": " << total.intersection_tests << ",\n";
+	file << "  \"bvh_node_visits\": " << total.bvh_node_visits << ",\n";
+	file << "  \"scatters\": { \"lambertian\": " << total.scatters[0] << ", \"metal\": " << total.scatters[1]
+		<< ", \"dielectric\": " << total.scatters[2] << " },\n";
+	file << "  \"per_thread\": [\n";
+	for (size_t t = 0; t < workers.size(); t++) {
+		uint64_t n = workers[t].total_rays();
+		file << "    { \"rays\": " << n << ", \"seconds\": " << workers[t].seconds
+			<< ", \"rays_per_second\": " << (workers[t].seconds > 0 ? n / workers[t].seconds : 0) << " }"
+			<< (t + 1 < workers.size() ? "," : "") << "\n";
+	}
+	file << "  ]\n";
+	file << "}\n";
+
+	return file.good();
+}
+
+#endif // !STATS_H
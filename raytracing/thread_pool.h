@@ -0,0 +1,135 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run index ranges in parallel.
+// Each worker owns a deque of task indices: it pops work from the front of its own
+// deque and, once empty, steals from the back of the other workers' deques.
+class thread_pool {
+public:
+	explicit thread_pool(int thread_count = 0) {
+		if (thread_count <= 0)
+			thread_count = static_cast<int>(std::thread::hardware_concurrency());
+		thread_count = thread_count < 1 ? 1 : thread_count;
+
+		for (int k = 0; k < thread_count; k++)
+			queues.push_back(std::make_unique<task_queue>());
+		for (int k = 0; k < thread_count; k++)
+			workers.emplace_back(&thread_pool::worker_loop, this, k);
+	}
+
+	~thread_pool() {
+		{
+			std::lock_guard<std::mutex> guard(job_lock);
+			stopping = true;
+		}
+		job_cv.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	int size() const { return static_cast<int>(workers.size()); }
+
+	// run task(index, worker) for every index in [0, task_count), blocks until all finished
+	void parallel_for(int task_count, const std::function<void(int, int)>& task) {
+		if (task_count <= 0) return;
+
+		std::unique_lock<std::mutex> guard(job_lock);
+
+		// hand every worker a contiguous block so neighbouring tiles stay on one thread
+		int n = size();
+		for (int k = 0; k < n; k++) {
+			std::lock_guard<std::mutex> queue_guard(queues[k]->lock);
+			for (int i = task_count * k / n; i < task_count * (k + 1) / n; i++)
+				queues[k]->tasks.push_back(i);
+		}
+
+		job = &task;
+		finished = 0;
+		generation++;
+		job_cv.notify_all();
+
+		done_cv.wait(guard, [&] { return finished == n; });
+		job = nullptr;
+	}
+
+private:
+	struct task_queue {
+		std::mutex lock;
+		std::deque<int> tasks;
+	};
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<task_queue>> queues;
+
+	std::mutex job_lock;
+	std::condition_variable job_cv;
+	std::condition_variable done_cv;
+	const std::function<void(int, int)>* job = nullptr;
+	unsigned long long generation = 0;
+	int finished = 0;
+	bool stopping = false;
+
+	bool pop_task(int worker, int& index) {
+		// own work first, from the front
+		{
+			auto& own = *queues[worker];
+			std::lock_guard<std::mutex> guard(own.lock);
+			if (!own.tasks.empty()) {
+				index = own.tasks.front();
+				own.tasks.pop_front();
+				return true;
+			}
+		}
+
+		// steal from the back of the other workers
+		int n = size();
+		for (int k = 1; k < n; k++) {
+			auto& victim = *queues[(worker + k) % n];
+			std::lock_guard<std::mutex> guard(victim.lock);
+			if (!victim.tasks.empty()) {
+				index = victim.tasks.back();
+				victim.tasks.pop_back();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void worker_loop(int worker) {
+		unsigned long long seen = 0;
+
+		while (true) {
+			const std::function<void(int, int)>* task;
+			{
+				std::unique_lock<std::mutex> guard(job_lock);
+				job_cv.wait(guard, [&] { return stopping || generation != seen; });
+				if (stopping) return;
+				seen = generation;
+				task = job;
+			}
+
+			int index;
+			while (pop_task(worker, index))
+				(*task)(index, worker);
+
+			{
+				std::lock_guard<std::mutex> guard(job_lock);
+				finished++;
+			}
+			done_cv.notify_one();
+		}
+	}
+};
+
+#endif // !THREAD_POOL_H
@@ -0,0 +1,104 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "rtweekend.h"
+
+// Affine 3x4 transform: a 3x3 linear part and a translation in the last column
+class transform {
+public:
+	float m[3][4];
+
+	transform() : m{ {1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0} } {}
+
+	static transform translate(const vec3& offset) {
+		transform t;
+		for (int r = 0; r < 3; r++) t.m[r][3] = offset[r];
+		return t;
+	}
+
+	static transform scale(const vec3& factor) {
+		transform t;
+		for (int r = 0; r < 3; r++) t.m[r][r] = factor[r];
+		return t;
+	}
+
+	static transform scale(float factor) {
+		return scale(vec3(factor, factor, factor));
+	}
+
+	// rotation by angle degrees around axis, counter-clockwise looking down the axis
+	static transform rotate(const vec3& axis, float degrees) {
+		vec3 a = unit_vector(axis);
+		float s = sin(degrees_to_radians(degrees));
+		float c = cos(degrees_to_radians(degrees));
+		float k = 1.f - c;
+
+		transform t;
+		t.m[0][0] = a.x() * a.x() * k + c;         t.m[0][1] = a.x() * a.y() * k - a.z() * s; t.m[0][2] = a.x() * a.z() * k + a.y() * s;
+		t.m[1][0] = a.y() * a.x() * k + a.z() * s; t.m[1][1] = a.y() * a.y() * k + c;         t.m[1][2] = a.y() * a.z() * k - a.x() * s;
+		t.m[2][0] = a.z() * a.x() * k - a.y() * s; t.m[2][1] = a.z() * a.y() * k + a.x() * s; t.m[2][2] = a.z() * a.z() * k + c;
+		return t;
+	}
+
+	point3 apply_point(const point3& p) const {
+		return point3(
+			m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+			m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+			m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+	}
+
+	vec3 apply_vector(const vec3& v) const {
+		return vec3(
+			m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+			m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+			m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+	}
+
+	// multiply by the transposed linear part. Called on the world-to-object transform this
+	// is the inverse transpose of object-to-world, which is how normals transform.
+	vec3 apply_transposed(const vec3& v) const {
+		return vec3(
+			m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+			m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+			m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z());
+	}
+
+	transform inverse() const {
+		// inverse of the linear part from its cofactors
+		float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+		float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+		float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+		float det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+		float inv_det = 1.f / det;
+
+		transform t;
+		t.m[0][0] = c00 * inv_det;
+		t.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+		t.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+		t.m[1][0] = c01 * inv_det;
+		t.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+		t.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+		t.m[2][0] = c02 * inv_det;
+		t.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+		t.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+		// undo the translation in the rotated frame
+		vec3 offset = t.apply_vector(vec3(m[0][3], m[1][3], m[2][3]));
+		for (int r = 0; r < 3; r++) t.m[r][3] = -offset[r];
+		return t;
+	}
+};
+
+// a * b applies b first, then a
+inline transform operator*(const transform& a, const transform& b) {
+	transform t;
+	for (int r = 0; r < 3; r++) {
+		for (int c = 0; c < 4; c++) {
+			t.m[r][c] = a.m[r][0] * b.m[0][c] + a.m[r][1] * b.m[1][c] + a.m[r][2] * b.m[2][c];
+		}
+		t.m[r][3] += a.m[r][3];
+	}
+	return t;
+}
+
+#endif // !TRANSFORM_H
@@ -6,6 +6,84 @@
 
 using std::sqrt;
 
+// Define RT_VEC3_SIMD to back vec3 with SSE registers instead of three scalar floats.
+// Both backends have the same interface.
+#if defined(RT_VEC3_SIMD)
+#include <immintrin.h>
+
+// 4-wide SSE backend: padded to 16 bytes, the fourth lane is always zero
+class alignas(16) vec3 {
+public:
+      
+
+      vec3() : m(_mm_setzero_ps()) {}
+      vec3(float e0, float e1, float e2): m(_mm_setr_ps(e0, e1, e2, 0.f)) {}
+      explicit vec3(__m128 v) : m(v) {}
+
+      float x() const { return e[0]; };
+      float y() const { return e[1]; };
+      float z() const { return e[2]; };
+
+      vec3 operator-() const { return vec3(_mm_sub_ps(_mm_setzero_ps(), m)); };
+      float operator[](int i) const { return e[i]; };
+      float& operator[](int i) { return e[i]; };
+      
+      vec3& operator+=(const vec3& v) {
+          m = _mm_add_ps(m, v.m);
+          return *this;
+      }
+      vec3& operator*=(float t) {
+          m = _mm_mul_ps(m, scalar3(t));
+          return *this;
+      }
+
+      vec3& operator/=(float t) {
+          return *this *= (1 / t);
+      }
+
+      float length() const {
+          return sqrt(length_squared());
+      }
+
+      float length_squared() const {
+          return dot3(m, m);
+      }
+
+      bool near_zero() const {
+          auto s = 1e-8;
+          return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
+      }
+      
+      static vec3 random() {
+          return vec3(random_float(), random_float(), random_float());
+      }
+
+      static vec3 random(float min, float max) {
+          return vec3(random_float(min, max), random_float(min, max), random_float(min, max));
+      }
+
+      // t in the three used lanes; the fourth stays zero when t is infinite or NaN, as from
+      // a division by zero
+      static __m128 scalar3(float t) {
+          return _mm_setr_ps(t, t, t, 0.f);
+      }
+
+      // x*x' + y*y' + z*z', summed in the same order as the scalar backend
+      static float dot3(__m128 u, __m128 v) {
+          __m128 p = _mm_mul_ps(u, v);
+          __m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1));
+          __m128 z = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2));
+          return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(p, y), z));
+      }
+
+public:
+    union {
+        __m128 m;
+        float e[4];
+    };
+};
+
+#else
 class vec3 {
 public:
       
@@ -48,7 +126,7 @@ public:
 
       bool near_zero() const {
           auto s = 1e-8;
-          return (fabs(e[0] < s) && fabs(e[1] < s) && fabs(e[2] < s));
+          return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
       }
       
       static vec3 random() {
@@ -63,6 +141,8 @@ public:
     float e[3];
 };
 
+#endif
+
 // point3 is just alias for vec3
 using point3 = vec3;
 
@@ -72,6 +152,49 @@ inline std::ostream& operator<<(std::ostream& os, const vec3& v) {
     return os << v.e[0] << " " << v.e[1] << "" << v.e[2];
 }
 
+#if defined(RT_VEC3_SIMD)
+inline vec3 operator+(const vec3 &u, const vec3 &v) {
+    return vec3(_mm_add_ps(u.m, v.m));
+}
+
+inline vec3 operator-(const vec3 &u, const vec3 &v) {
+    return vec3(_mm_sub_ps(u.m, v.m));
+}
+
+inline vec3 operator*(const vec3& u, const vec3& v) {
+    return vec3(_mm_mul_ps(u.m, v.m));
+}
+
+
+inline vec3 operator*(float t, const vec3& v) {
+    return vec3(_mm_mul_ps(vec3::scalar3(t), v.m));
+}
+
+inline vec3 operator*(const vec3& u, float t) {
+    return t * u;
+}
+
+inline vec3 operator/(vec3 v, float t) {
+    return (1 / t) * v;
+}
+
+inline float dot(const vec3& u, const vec3& v) {
+    return vec3::dot3(u.m, v.m);
+}
+
+inline vec3 cross(const vec3& u, const vec3& v) {
+    // u * v.yzx - u.yzx * v gives the cross product in zxy order
+    __m128 u_yzx = _mm_shuffle_ps(u.m, u.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 v_yzx = _mm_shuffle_ps(v.m, v.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(u.m, v_yzx), _mm_mul_ps(u_yzx, v.m));
+    return vec3(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+}
+
+inline vec3 unit_vector(vec3 v) {
+    return v / v.length();
+}
+
+#else
 inline vec3 operator+(const vec3 &u, const vec3 &v) {
     return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
@@ -111,12 +234,27 @@ inline vec3 unit_vector(vec3 v) {
     return v / v.length();
 }
 
+#endif
+
 inline vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = vec3(random_float(-1, 1), random_float(-1, 1), 0);
-        if (p.length_squared() < 1)
-            return p;
+    // concentric map of the square onto the disk (Shirley and Chiu 1997): no rejection,
+    // so one 2D sample is always enough and its stratification carries over
+    float a, b;
+    random_float2(a, b);
+    a = 2.f * a - 1.f;
+    b = 2.f * b - 1.f;
+    if (a == 0.f && b == 0.f)
+        return vec3(0, 0, 0);
+    float r, theta;
+    if (fabs(a) > fabs(b)) {
+        r = a;
+        theta = (pi / 4.f) * (b / a);
+    }
+    else {
+        r = b;
+        theta = (pi / 2.f) - (pi / 4.f) * (a / b);
     }
+    return vec3(r * cos(theta), r * sin(theta), 0);
 }
 
 inline vec3 random_in_unit_sphere() {
@@ -128,7 +266,13 @@ inline vec3 random_in_unit_sphere() {
 }
 
 inline vec3 random_unit_vector() {
-    return unit_vector(random_in_unit_sphere());
+    // uniform on the sphere without rejection: uniform z, uniform angle around it
+    float u1, u2;
+    random_float2(u1, u2);
+    auto z = 1.f - 2.f * u1;
+    auto r = sqrt(fmax(0.f, 1.f - z * z));
+    auto phi = 2.f * pi * u2;
+    return vec3(r * cos(phi), r * sin(phi), z);
 }
 
 inline vec3 random_on_hemisphere(const vec3& normal) {
@@ -0,0 +1,39 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "rtweekend.h"
+
+#include "aov.h"
+#include "color.h"
+#include "hittable.h"
+
+#include <vector>
+
+// State of one path in flight in the wavefront integrator. Every path carries its own
+// random stream, so the result does not depend on the order the queues are processed in.
+struct wavefront_path {
+	ray r;
+	color throughput;
+	color radiance; // collected from emitters so far
+	float bsdf_pdf; // density of the last scatter direction, 0 after specular bounces
+	int pixel; // index into the pixel list of the tile
+	aov_sample aov; // features for the denoiser, when collected
+	random_generator rng;
+	sample_sequence sequence;
+};
+
+// One bounce worth of paths plus the scratch space of the stages working on it
+struct wavefront_queue {
+	std::vector<wavefront_path> paths;
+	std::vector<wavefront_path> next; // survivors, compacted for the next bounce
+	std::vector<hit_record> recs;
+	std::vector<unsigned char> hits;
+	std::vector<int> bins[3]; // path indices binned by the material_type of the scattering materials
+
+	void clear() {
+		paths.clear();
+		next.clear();
+	}
+};
+
+#endif // !WAVEFRONT_H
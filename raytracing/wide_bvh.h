@@ -0,0 +1,418 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+// q * step + offset; FMA comes with AVX2 on every CPU, but gcc and clang only allow its
+// intrinsics with -mfma, MSVC always
+#if defined(__FMA__) || defined(_MSC_VER)
+#define WIDE_BVH_MADD256(q, step, offset) _mm256_fmadd_ps(q, step, offset)
+#define WIDE_BVH_MADD128(q, step, offset) _mm_fmadd_ps(q, step, offset)
+#else
+#define WIDE_BVH_MADD256(q, step, offset) _mm256_add_ps(_mm256_mul_ps(q, step), offset)
+#define WIDE_BVH_MADD128(q, step, offset) _mm_add_ps(_mm_mul_ps(q, step), offset)
+#endif
+#endif
+
+// BVH with N = 4 or 8 children per node, flattened into one array of cache line aligned
+// nodes. Child boxes are stored in 8 bits per plane, as steps of a power of two size
+// from the node's corner (Ylitie et al. 2017), rounded outwards so they always enclose
+// the child: a BVH4 node is 64 bytes, a BVH8 node 128. One ray tests all children of a
+// node at once, with AVX2 when available, and visits the hit ones nearest first; entries
+// on the stack keep their entry distance, so those behind the closest hit are skipped.
+// Built by collapsing the binary SAH tree of bvh_node. Drop in for bvh_node: same hits,
+// same refit.
+template <int N>
+class wide_bvh : public hittable {
+	static_assert(N == 4 || N == 8, "wide_bvh has 4 or 8 children per node");
+
+public:
+	wide_bvh(const hittable_list& list) : wide_bvh(list.objects) {}
+
+	wide_bvh(const std::vector<shared_ptr<hittable>>& list) {
+		if (list.empty()) return;
+
+		std::vector<bvh_primitive> prims(list.size());
+		for (size_t i = 0; i < list.size(); i++) {
+			prims[i].box = list[i]->bounding_box();
+			prims[i].centroid = prims[i].box.centroid();
+			prims[i].index = static_cast<int>(i);
+		}
+
+		std::vector<binary_node> tree;
+		tree.reserve(2 * list.size());
+		build_binary(tree, prims, 0, prims.size(), 0);
+
+		// leaves refer to ranges of the primitives in build order
+		objects.resize(list.size());
+		for (size_t i = 0; i < prims.size(); i++)
+			objects[i] = list[prims[i].index];
+
+		nodes.reserve(tree.size() / (N / 2) + 1);
+		collapse(tree, 0);
+		bbox = tree[0].box;
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+		if (nodes.empty())
+			return false;
+
+		point3 o = r.origin();
+		vec3 d = r.direction();
+		// a finite inverse for axis parallel rays, an infinite one would make 0 * inf planes
+		float inv[3];
+		for (int a = 0; a < 3; a++)
+			inv[a] = std::fabs(d[a]) > 1e-30f ? 1.f / d[a] : std::copysign(1e30f, d[a]);
+		float origin[3] = { o.x(), o.y(), o.z() };
+		// byte offset of the near planes within a node: the low bounds for a positive
+		// direction, the high ones for a negative
+		int near_plane[3], far_plane[3];
+		for (int a = 0; a < 3; a++) {
+			near_plane[a] = offsetof(node, lo) + (inv[a] < 0 ? 3 * N : 0) + a * N;
+			far_plane[a] = offsetof(node, lo) + (inv[a] < 0 ? 0 : 3 * N) + a * N;
+		}
+
+		float closest = ray_t.max;
+		bool hit_anything = false;
+
+		stack_entry stack[stack_size];
+		int top = 0;
+		stack[top++] = { 0u, ray_t.min };
+
+		while (top > 0) {
+			stack_entry entry = stack[--top];
+			// a closer hit turned up since the entry was pushed
+			if (entry.t > closest)
+				continue;
+
+			if (entry.child & leaf_flag) {
+				uint32_t start = (entry.child & ~leaf_flag) >> 3, count = (entry.child & 7u) + 1;
+				for (uint32_t k = start; k < start + count; k++) {
+					if (objects[k]->hit(r, interval(ray_t.min, closest), rec)) {
+						hit_anything = true;
+						closest = rec.t;
+					}
+				}
+				continue;
+			}
+
+			const node& n = nodes[entry.child];
+			RT_STATS_ADD(bvh_node_visits, 1);
+
+			float t_near[N];
+			unsigned int mask = intersect_children(n, origin, inv, near_plane, far_plane, ray_t.min, closest, t_near);
+
+			// sort the hit children by distance, then push them far to near
+			stack_entry hits[N];
+			int count = 0;
+			for (; mask; mask &= mask - 1) {
+				int c = lowest_bit(mask);
+				stack_entry e = { n.child[c], t_near[c] };
+				int k = count++;
+				for (; k > 0 && hits[k - 1].t < e.t; k--)
+					hits[k] = hits[k - 1];
+				hits[k] = e;
+			}
+			for (int k = 0; k < count; k++)
+				stack[top++] = hits[k];
+		}
+
+		return hit_anything;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	// New bounds for moved primitives, keeping the tree: every node is requantized
+	// around the refit boxes of its children
+	void refit() override {
+		if (nodes.empty()) return;
+		for (const auto& object : objects)
+			object->refit();
+		bbox = refit_node(0);
+	}
+
+	// bytes of node storage, for comparing layouts
+	size_t node_bytes() const { return nodes.size() * sizeof(node); }
+
+private:
+	static const uint32_t leaf_flag = 0x80000000u; // set in child references to leaves
+	static const uint32_t empty_child = 0xffffffffu;
+	static const int max_leaf_size = 2; // primitives per leaf, at most 8
+	static const int max_depth = 126; // of the binary tree, bounds the traversal stack
+	static const int stack_size = (N - 1) * max_depth + 1;
+
+	// A child reference is a node index, a leaf (leaf_flag, first primitive << 3 and
+	// count - 1) or empty_child. Bounds are lo[axis][child] and hi[axis][child] in steps
+	// of scale[axis] from corner; empty slots have lo above hi and are never hit.
+	struct alignas(N * 16) node {
+		float corner[3];
+		float scale[3];
+		uint8_t lo[3][N];
+		uint8_t hi[3][N];
+		uint32_t child[N];
+	};
+	static_assert(sizeof(node) == N * 16, "a node fills whole cache lines");
+
+	struct stack_entry {
+		uint32_t child;
+		float t; // entry distance of the ray into the child's box
+	};
+
+	struct binary_node {
+		aabb box;
+		int left = -1, right = -1; // children of an interior node
+		int start = 0, count = 0; // primitives of a leaf
+	};
+
+	std::vector<node> nodes;
+	std::vector<shared_ptr<hittable>> objects;
+	aabb bbox;
+
+	static int lowest_bit(unsigned int mask) {
+		int c = 0;
+		while (!(mask >> c & 1u)) c++;
+		return c;
+	}
+
+	int build_binary(std::vector<binary_node>& tree, std::vector<bvh_primitive>& prims, size_t start, size_t end, int depth) {
+		int index = static_cast<int>(tree.size());
+		tree.push_back(binary_node());
+
+		aabb box;
+		for (size_t k = start; k < end; k++)
+			box = aabb(box, prims[k].box);
+		tree[index].box = box;
+
+		if (end - start <= static_cast<size_t>(max_leaf_size)) {
+			tree[index].start = static_cast<int>(start);
+			tree[index].count = static_cast<int>(end - start);
+			return index;
+		}
+
+		// past half the depth budget fall back to median splits, which halve the count every level
+		size_t mid;
+		if (depth < max_depth / 2) {
+			mid = sah_partition(prims, start, end);
+		}
+		else {
+			aabb centroids;
+			for (size_t k = start; k < end; k++)
+				centroids = aabb(centroids, aabb(prims[k].centroid, prims[k].centroid));
+			int axis = centroids.longest_axis();
+			mid = start + (end - start) / 2;
+			std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+				[axis](const bvh_primitive& a, const bvh_primitive& b) { return a.centroid[axis] < b.centroid[axis]; });
+		}
+
+		int left = build_binary(tree, prims, start, mid, depth + 1);
+		int right = build_binary(tree, prims, mid, end, depth + 1);
+		tree[index].left = left;
+		tree[index].right = right;
+		return index;
+	}
+
+	// Emit the wide node for binary node b: its children are found by opening the largest
+	// interior descendant until N are gathered, the rest of the subtree follows depth first
+	uint32_t collapse(const std::vector<binary_node>& tree, int b) {
+		std::vector<int> children;
+		if (tree[b].left < 0) {
+			children.push_back(b);
+		}
+		else {
+			children.push_back(tree[b].left);
+			children.push_back(tree[b].right);
+		}
+		while (static_cast<int>(children.size()) < N) {
+			int widest = -1;
+			for (int k = 0; k < static_cast<int>(children.size()); k++) {
+				const binary_node& c = tree[children[k]];
+				if (c.left >= 0 && (widest < 0 || c.box.surface_area() > tree[children[widest]].box.surface_area()))
+					widest = k;
+			}
+			if (widest < 0) break;
+			int opened = children[widest];
+			children[widest] = tree[opened].left;
+			children.push_back(tree[opened].right);
+		}
+
+		uint32_t index = static_cast<uint32_t>(nodes.size());
+		nodes.push_back(node());
+
+		uint32_t refs[N];
+		aabb boxes[N];
+		for (int k = 0; k < N; k++) {
+			refs[k] = empty_child;
+			if (k >= static_cast<int>(children.size())) continue;
+			const binary_node& c = tree[children[k]];
+			boxes[k] = c.box;
+			if (c.left < 0)
+				refs[k] = leaf_flag | static_cast<uint32_t>(c.start) << 3 | static_cast<uint32_t>(c.count - 1);
+			else
+				refs[k] = collapse(tree, children[k]);
+		}
+		quantize(nodes[index], refs, boxes);
+		return index;
+	}
+
+	// Store the child boxes of n as 8 bit steps from their common corner. The step is the
+	// smallest power of two that covers the extent in 255 steps, so corner + q * scale is
+	// exact but for the final rounding, which the widening loops below absorb.
+	static void quantize(node& n, const uint32_t* refs, const aabb* boxes) {
+		aabb all;
+		for (int k = 0; k < N; k++)
+			if (refs[k] != empty_child) all = aabb(all, boxes[k]);
+
+		for (int a = 0; a < 3; a++) {
+			float base = all.axis(a).min;
+			float extent = all.axis(a).max - base;
+			float scale = extent > 0 ? std::ldexp(1.f, static_cast<int>(std::ceil(std::log2(extent / 255.f)))) : 1.f;
+			while (scale * 255.f < extent) scale *= 2;
+			n.corner[a] = base;
+			n.scale[a] = scale;
+
+			for (int k = 0; k < N; k++) {
+				if (refs[k] == empty_child) {
+					n.lo[a][k] = 255;
+					n.hi[a][k] = 0;
+					continue;
+				}
+				const interval& slab = boxes[k].axis(a);
+				int lo = std::max(0, static_cast<int>(std::floor((slab.min - base) / scale)));
+				int hi = std::min(255, static_cast<int>(std::ceil((slab.max - base) / scale)));
+				while (lo > 0 && base + lo * scale > slab.min) lo--;
+				while (hi < 255 && base + hi * scale < slab.max) hi++;
+				n.lo[a][k] = static_cast<uint8_t>(lo);
+				n.hi[a][k] = static_cast<uint8_t>(hi);
+			}
+		}
+		for (int k = 0; k < N; k++)
+			n.child[k] = refs[k];
+	}
+
+	aabb refit_node(uint32_t index) {
+		uint32_t refs[N];
+		aabb boxes[N];
+		aabb all;
+		for (int k = 0; k < N; k++) {
+			refs[k] = nodes[index].child[k];
+			if (refs[k] == empty_child) continue;
+			if (refs[k] & leaf_flag) {
+				uint32_t start = (refs[k] & ~leaf_flag) >> 3, count = (refs[k] & 7u) + 1;
+				for (uint32_t p = start; p < start + count; p++)
+					boxes[k] = aabb(boxes[k], objects[p]->bounding_box());
+			}
+			else {
+				boxes[k] = refit_node(refs[k]);
+			}
+			all = aabb(all, boxes[k]);
+		}
+		quantize(nodes[index], refs, boxes);
+		return all;
+	}
+
+	// Slab test of the ray against every child box of n within (tmin, tmax). Per axis the
+	// plane of step q lies at t = q * scale * inv + (corner - origin) * inv, one multiply-add.
+	// Should a plane still come out NaN the min and max keep their old bound, so it never
+	// culls. Returns the mask of hit children, with their entry distances in t_near.
+	static unsigned int intersect_children(const node& n, const float* origin, const float* inv,
+		const int* near_plane, const int* far_plane, float tmin, float tmax, float* t_near) {
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&n);
+#if defined(__AVX2__)
+		if (N == 8) {
+			__m256 t0 = _mm256_set1_ps(tmin), t1 = _mm256_set1_ps(tmax);
+			for (int a = 0; a < 3; a++) {
+				__m256 step = _mm256_set1_ps(n.scale[a] * inv[a]);
+				__m256 offset = _mm256_set1_ps((n.corner[a] - origin[a]) * inv[a]);
+				__m256 qn = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(bytes + near_plane[a]))));
+				__m256 qf = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(bytes + far_plane[a]))));
+				t0 = _mm256_max_ps(WIDE_BVH_MADD256(qn, step, offset), t0);
+				t1 = _mm256_min_ps(WIDE_BVH_MADD256(qf, step, offset), t1);
+			}
+			_mm256_storeu_ps(t_near, t0);
+			return static_cast<unsigned int>(_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)));
+		}
+		else {
+			__m128 t0 = _mm_set1_ps(tmin), t1 = _mm_set1_ps(tmax);
+			for (int a = 0; a < 3; a++) {
+				__m128 step = _mm_set1_ps(n.scale[a] * inv[a]);
+				__m128 offset = _mm_set1_ps((n.corner[a] - origin[a]) * inv[a]);
+				int near_bytes, far_bytes;
+				std::memcpy(&near_bytes, bytes + near_plane[a], 4);
+				std::memcpy(&far_bytes, bytes + far_plane[a], 4);
+				__m128 qn = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(near_bytes)));
+				__m128 qf = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(far_bytes)));
+				t0 = _mm_max_ps(WIDE_BVH_MADD128(qn, step, offset), t0);
+				t1 = _mm_min_ps(WIDE_BVH_MADD128(qf, step, offset), t1);
+			}
+			_mm_storeu_ps(t_near, t0);
+			return static_cast<unsigned int>(_mm_movemask_ps(_mm_cmple_ps(t0, t1)));
+		}
+#else
+		// plain lane loops, for the compiler to vectorize
+		float t1[N];
+		for (int c = 0; c < N; c++) {
+			t_near[c] = tmin;
+			t1[c] = tmax;
+		}
+		for (int a = 0; a < 3; a++) {
+			float step = n.scale[a] * inv[a];
+			float offset = (n.corner[a] - origin[a]) * inv[a];
+			const unsigned char* qn = bytes + near_plane[a];
+			const unsigned char* qf = bytes + far_plane[a];
+			for (int c = 0; c < N; c++) {
+				float ta = qn[c] * step + offset, tb = qf[c] * step + offset;
+				t_near[c] = ta > t_near[c] ? ta : t_near[c];
+				t1[c] = tb < t1[c] ? tb : t1[c];
+			}
+		}
+		unsigned int mask = 0;
+		for (int c = 0; c < N; c++)
+			mask |= (t_near[c] <= t1[c] ? 1u : 0u) << c;
+		return mask;
+#endif
+	}
+};
+
+typedef wide_bvh<4> bvh4;
+typedef wide_bvh<8> bvh8;
+
+// Node layouts of a world BVH
+enum class bvh_layout {
+	binary, // bvh_node
+	wide4, // bvh4
+	wide8, // bvh8
+};
+
+inline shared_ptr<hittable> make_bvh(const hittable_list& list, bvh_layout layout) {
+	if (layout == bvh_layout::wide4)
+		return make_shared<bvh4>(list);
+	if (layout == bvh_layout::wide8)
+		return make_shared<bvh8>(list);
+	return make_shared<bvh_node>(list);
+}
+
+// "binary", "bvh4" or "bvh8"; false for anything else
+inline bool parse_bvh_layout(const std::string& name, bvh_layout& layout) {
+	if (name == "binary") layout = bvh_layout::binary;
+	else if (name == "bvh4") layout = bvh_layout::wide4;
+	else if (name == "bvh8") layout = bvh_layout::wide8;
+	else return false;
+	return true;
+}
+
+#endif // !WIDE_BVH_H